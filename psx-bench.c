@@ -0,0 +1,829 @@
+/*
+  Copyright 2023 Michael Panzlaff <michael.panlaff@fau.de>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/**
+   Offline benchmark and regression harness for the PSX reverb plugin.
+
+   The plugin is driven only through its `LV2_Descriptor`, like a host would.
+   Noise, full scale noise and impulse signals are streamed through every
+   preset at the given samplerates and block sizes.  The results are
+   reported in ns/sample, worst case `run()` time per block and (on Linux)
+   cache misses.
+
+   With `-w DIR` the output of every case is written to DIR as reference.  With
+   `-g DIR` the output is compared against them instead, so a new engine or
+   kernel can be checked against the output of the scalar loop of an older
+   build.
+
+   With `-k COUNT`, COUNT stereo reverbs run as a bank and as single
+   instances through the C interface instead, on the same input.  Both are
+   timed and their outputs compared, they have to be the same.
+*/
+
+#define _GNU_SOURCE
+
+#include "lv2/core/lv2.h"
+#include "lv2/atom/atom.h"
+#include "lv2/log/log.h"
+#include "lv2/urid/urid.h"
+#include "lv2/worker/worker.h"
+
+#include "psx-reverb.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+/* the stereo plugin's ports, see psx-reverb.ttl */
+enum {
+    PORT_WET = 0,
+    PORT_DRY,
+    PORT_PRESET,
+    PORT_MASTER,
+    PORT_IN0,
+    PORT_IN1,
+    PORT_OUT0,
+    PORT_OUT1,
+    PORT_NATIVE,
+    PORT_ENGINE,
+    PORT_CONTROL,
+    PORT_CROSSFADE,
+    NUM_PORTS
+};
+
+#define NUM_PRESETS 10
+#define LIST_MAX 16
+#define URIS_MAX 64
+#define WORK_MAX 16
+#define WORK_SIZE 256
+
+typedef enum {
+    SIGNAL_NOISE,
+    SIGNAL_IMPULSE,
+    SIGNAL_FULL,
+    NUM_SIGNALS
+} Signal;
+
+static const char *signal_names[NUM_SIGNALS] = { "noise", "impulse", "full" };
+
+typedef struct {
+    int values[LIST_MAX];
+    int count;
+} List;
+
+typedef struct {
+    List presets;
+    List rates;
+    List blocks;
+    List engines;
+    List natives;
+    double seconds;
+    float wet;
+    bool worker;
+    const char *write_dir;
+    const char *golden_dir;
+    float tolerance;
+    const char *ir_dir;
+    double ir_seconds;
+    int bank;
+} Options;
+
+/* a minimal host: URID map, log and a worker that runs between two `run()` calls */
+typedef struct {
+    char *uris[URIS_MAX];
+    uint32_t n_uris;
+
+    uint8_t work[WORK_MAX][WORK_SIZE];
+    uint32_t work_size[WORK_MAX];
+    uint32_t n_work;
+    uint8_t responses[WORK_MAX][WORK_SIZE];
+    uint32_t response_size[WORK_MAX];
+    uint32_t n_responses;
+} Host;
+
+static LV2_URID
+host_map(LV2_URID_Map_Handle handle, const char *uri)
+{
+    Host *host = (Host *)handle;
+
+    for (uint32_t i = 0; i < host->n_uris; i++) {
+        if (!strcmp(host->uris[i], uri))
+            return i + 1;
+    }
+    if (host->n_uris == URIS_MAX)
+        return 0;
+    host->uris[host->n_uris] = strdup(uri);
+    return ++host->n_uris;
+}
+
+/* the plugin traces its load every second, only errors and warnings are of interest here */
+static int
+host_vprintf(LV2_Log_Handle handle, LV2_URID type, const char *fmt, va_list ap)
+{
+    if (type == host_map(handle, LV2_LOG__Trace))
+        return 0;
+    return vfprintf(stderr, fmt, ap);
+}
+
+static int
+host_printf(LV2_Log_Handle handle, LV2_URID type, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    const int ret = host_vprintf(handle, type, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+static LV2_Worker_Status
+host_schedule(LV2_Worker_Schedule_Handle handle, uint32_t size, const void *data)
+{
+    Host *host = (Host *)handle;
+
+    if (host->n_work == WORK_MAX || size > WORK_SIZE)
+        return LV2_WORKER_ERR_NO_SPACE;
+    memcpy(host->work[host->n_work], data, size);
+    host->work_size[host->n_work++] = size;
+    return LV2_WORKER_SUCCESS;
+}
+
+static LV2_Worker_Status
+host_respond(LV2_Worker_Respond_Handle handle, uint32_t size, const void *data)
+{
+    Host *host = (Host *)handle;
+
+    if (host->n_responses == WORK_MAX || size > WORK_SIZE)
+        return LV2_WORKER_ERR_NO_SPACE;
+    memcpy(host->responses[host->n_responses], data, size);
+    host->response_size[host->n_responses++] = size;
+    return LV2_WORKER_SUCCESS;
+}
+
+static void
+host_run_worker(Host *host, LV2_Handle instance, const LV2_Worker_Interface *iface)
+{
+    for (uint32_t i = 0; i < host->n_work; i++)
+        iface->work(instance, host_respond, host, host->work_size[i], host->work[i]);
+    host->n_work = 0;
+    for (uint32_t i = 0; i < host->n_responses; i++)
+        iface->work_response(instance, host->response_size[i], host->responses[i]);
+    host->n_responses = 0;
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* hardware cache miss counter for the calling thread, -1 if not available */
+static int
+misses_open(void)
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static void
+misses_enable(int fd, bool enable)
+{
+#ifdef __linux__
+    if (fd >= 0) {
+        if (enable)
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, enable ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+    }
+#endif
+}
+
+static long long
+misses_read(int fd)
+{
+    long long count = -1;
+
+    if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+        return -1;
+    return count;
+}
+
+/* deterministic test signals, the same on every machine */
+static float
+noise(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return (float)(int32_t)*state * (0.5f / 2147483648.0f);
+}
+
+static void
+signal_fill(Signal signal, uint64_t pos, uint32_t rate, uint32_t *state, float *l, float *r, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        if (signal == SIGNAL_NOISE) {
+            l[i] = noise(state);
+            r[i] = noise(state);
+        } else if (signal == SIGNAL_FULL) {
+            /* full scale, so the fixed point engine saturates */
+            l[i] = noise(state) < 0.0f ? -1.0f : 1.0f;
+            r[i] = noise(state) < 0.0f ? -1.0f : 1.0f;
+        } else {
+            /* an impulse per second, left first and right half a second later */
+            const uint64_t t = (pos + i) % rate;
+            l[i] = t == 0 ? 1.0f : 0.0f;
+            r[i] = t == rate / 2 ? 1.0f : 0.0f;
+        }
+    }
+}
+
+/* a plugin instance with its host, ports and features */
+typedef struct {
+    const LV2_Descriptor       *desc;
+    LV2_Handle                  instance;
+    const LV2_Worker_Interface *iface;
+    Host                        host;
+    LV2_URID_Map                map;
+    LV2_Log_Log                 log;
+    LV2_Worker_Schedule         schedule;
+    LV2_Feature                 features[3];
+    const LV2_Feature          *feature_list[4];
+    float                       ctl[NUM_PORTS];
+    LV2_Atom_Sequence           control;    // always empty
+    float                      *in0;
+    float                      *in1;
+    float                      *out;    // both outputs of a block in a row
+    int                         block;
+} Plugin;
+
+static void
+plugin_close(Plugin *plugin)
+{
+    if (plugin->instance) {
+        plugin->desc->deactivate(plugin->instance);
+        plugin->desc->cleanup(plugin->instance);
+    }
+    for (uint32_t i = 0; i < plugin->host.n_uris; i++)
+        free(plugin->host.uris[i]);
+    free(plugin->in0);
+    free(plugin->in1);
+    free(plugin->out);
+}
+
+/* run one block and the worker requests it made, like a host between two cycles */
+static void
+plugin_run(Plugin *plugin)
+{
+    plugin->desc->run(plugin->instance, plugin->block);
+    host_run_worker(&plugin->host, plugin->instance, plugin->iface);
+}
+
+/* instantiate and activate the plugin, the preset and engine are set up before returning */
+static bool
+plugin_open(Plugin *plugin, const LV2_Descriptor *desc, const Options *opt, int preset, int rate,
+            int block, int engine, int native, float wet, float dry)
+{
+    memset(plugin, 0, sizeof(*plugin));
+    plugin->desc = desc;
+    plugin->block = block;
+    plugin->map = (LV2_URID_Map){ &plugin->host, host_map };
+    plugin->log = (LV2_Log_Log){ &plugin->host, host_printf, host_vprintf };
+    plugin->schedule = (LV2_Worker_Schedule){ &plugin->host, host_schedule };
+    plugin->features[0] = (LV2_Feature){ LV2_URID__map, &plugin->map };
+    plugin->features[1] = (LV2_Feature){ LV2_LOG__log, &plugin->log };
+    plugin->features[2] = (LV2_Feature){ LV2_WORKER__schedule, &plugin->schedule };
+    plugin->feature_list[0] = &plugin->features[0];
+    plugin->feature_list[1] = &plugin->features[1];
+    plugin->feature_list[2] = opt->worker ? &plugin->features[2] : NULL;
+
+    plugin->in0 = calloc(block, sizeof(float));
+    plugin->in1 = calloc(block, sizeof(float));
+    plugin->out = calloc(2 * (size_t)block, sizeof(float));
+    if (!plugin->in0 || !plugin->in1 || !plugin->out) {
+        fprintf(stderr, "Could not allocate audio buffers\n");
+        plugin_close(plugin);
+        return false;
+    }
+
+    plugin->instance = desc->instantiate(desc, rate, ".", plugin->feature_list);
+    if (!plugin->instance) {
+        fprintf(stderr, "Could not instantiate the plugin at %d Hz\n", rate);
+        plugin_close(plugin);
+        return false;
+    }
+    plugin->iface = desc->extension_data(LV2_WORKER__interface);
+
+    plugin->ctl[PORT_WET] = wet;
+    plugin->ctl[PORT_DRY] = dry;
+    plugin->ctl[PORT_PRESET] = (float)preset;
+    plugin->ctl[PORT_NATIVE] = (float)native;
+    plugin->ctl[PORT_ENGINE] = (float)engine;
+    for (uint32_t p = 0; p < NUM_PORTS; p++)
+        desc->connect_port(plugin->instance, p, &plugin->ctl[p]);
+    desc->connect_port(plugin->instance, PORT_IN0, plugin->in0);
+    desc->connect_port(plugin->instance, PORT_IN1, plugin->in1);
+    desc->connect_port(plugin->instance, PORT_OUT0, plugin->out);
+    desc->connect_port(plugin->instance, PORT_OUT1, plugin->out + block);
+    plugin->control.atom.size = sizeof(plugin->control.body);
+    plugin->control.atom.type = host_map(&plugin->host, LV2_ATOM__Sequence);
+    desc->connect_port(plugin->instance, PORT_CONTROL, &plugin->control);
+
+    desc->activate(plugin->instance);
+
+    /* let the preset and engine switch and the gains settle on silence */
+    const uint64_t warmup = rate > 256 * block ? rate : 256 * block;
+    for (uint64_t pos = 0; pos < warmup; pos += block)
+        plugin_run(plugin);
+    return true;
+}
+
+typedef struct {
+    double ns_per_sample;
+    double worst_block_us;
+    double worst_block_load;
+    long long misses;
+    uint64_t samples;
+    float max_diff;
+    bool golden_missing;
+} Result;
+
+static void
+golden_path(char *path, size_t size, const char *dir, int preset, int rate, int block, int native, Signal signal)
+{
+    snprintf(path, size, "%s/p%d-%d-b%d-n%d-%s.raw", dir, preset, rate, block, native, signal_names[signal]);
+}
+
+static bool
+bench_case(const LV2_Descriptor *desc, const Options *opt, int preset, int rate, int block,
+           int engine, int native, Signal signal, Result *res)
+{
+    Plugin plugin;
+    if (!plugin_open(&plugin, desc, opt, preset, rate, block, engine, native, opt->wet, 0.0f))
+        return false;
+
+    char path[1024];
+    FILE *write_file = NULL;
+    FILE *golden_file = NULL;
+    if (opt->write_dir) {
+        golden_path(path, sizeof(path), opt->write_dir, preset, rate, block, native, signal);
+        write_file = fopen(path, "wb");
+        if (!write_file)
+            fprintf(stderr, "Could not write %s\n", path);
+    }
+    res->golden_missing = false;
+    if (opt->golden_dir) {
+        golden_path(path, sizeof(path), opt->golden_dir, preset, rate, block, native, signal);
+        golden_file = fopen(path, "rb");
+        res->golden_missing = golden_file == NULL;
+    }
+
+    float *golden = calloc(2 * (size_t)block, sizeof(float));
+    const uint64_t total = (uint64_t)(opt->seconds * rate);
+    uint32_t state = 1;
+    uint64_t elapsed = 0;
+    uint64_t worst = 0;
+    long long misses = 0;
+    const int misses_fd = misses_open();
+
+    res->max_diff = 0.0f;
+    for (uint64_t pos = 0; pos < total; pos += block) {
+        signal_fill(signal, pos, rate, &state, plugin.in0, plugin.in1, block);
+
+        misses_enable(misses_fd, true);
+        const uint64_t start = now_ns();
+        desc->run(plugin.instance, block);
+        const uint64_t stop = now_ns();
+        misses_enable(misses_fd, false);
+
+        host_run_worker(&plugin.host, plugin.instance, plugin.iface);
+
+        const long long m = misses_read(misses_fd);
+        misses = (m < 0 || misses < 0) ? -1 : misses + m;
+        elapsed += stop - start;
+        if (worst < stop - start)
+            worst = stop - start;
+
+        /* the reference files are interleaved stereo */
+        for (int i = 0; i < block; i++) {
+            golden[2 * i] = plugin.out[i];
+            golden[2 * i + 1] = plugin.out[block + i];
+        }
+        if (write_file)
+            fwrite(golden, sizeof(float), 2 * (size_t)block, write_file);
+        if (golden_file) {
+            for (int i = 0; i < 2 * block; i++) {
+                float ref;
+                if (fread(&ref, sizeof(ref), 1, golden_file) != 1) {
+                    res->golden_missing = true;
+                    break;
+                }
+                const float diff = fabsf(ref - golden[i]);
+                if (!(diff <= res->max_diff))
+                    res->max_diff = diff;
+            }
+        }
+    }
+
+    if (misses_fd >= 0)
+        close(misses_fd);
+    if (write_file)
+        fclose(write_file);
+    if (golden_file)
+        fclose(golden_file);
+
+    res->samples = total;
+    res->ns_per_sample = total ? (double)elapsed / (double)total : 0.0;
+    res->worst_block_us = (double)worst * 1e-3;
+    res->worst_block_load = (double)worst * 1e-9 * rate / block;
+    res->misses = misses_fd >= 0 ? misses : -1;
+
+    free(golden);
+    plugin_close(&plugin);
+    return true;
+}
+
+/**
+   Render the impulse responses of a preset from each input to each output
+   with dry signal off.  The network is linear, so this is all a convolution
+   engine would need.  The IR is cut where all four responses stay below
+   `IR_SILENCE`, at most after `opt->ir_seconds`.  The file holds the
+   responses L->L, L->R, R->L and R->R interleaved.
+*/
+#define IR_SILENCE 1e-5f
+#define IR_BLOCK 256
+
+static bool
+ir_case(const LV2_Descriptor *desc, const Options *opt, int preset, int rate, int native)
+{
+    const size_t max_len = (size_t)(opt->ir_seconds * rate + IR_BLOCK - 1) / IR_BLOCK * IR_BLOCK;
+    float *ir = calloc(4 * max_len, sizeof(float));
+    if (!ir) {
+        fprintf(stderr, "Could not allocate IR\n");
+        return false;
+    }
+
+    size_t len = 0;
+    for (int side = 0; side < 2; side++) {
+        Plugin plugin;
+        if (!plugin_open(&plugin, desc, opt, preset, rate, IR_BLOCK, 0, native, 0.0f, -90.0f)) {
+            free(ir);
+            return false;
+        }
+
+        for (size_t pos = 0; pos < max_len; pos += IR_BLOCK) {
+            memset(plugin.in0, 0, IR_BLOCK * sizeof(float));
+            memset(plugin.in1, 0, IR_BLOCK * sizeof(float));
+            if (pos == 0)
+                (side ? plugin.in1 : plugin.in0)[0] = 1.0f;
+            plugin_run(&plugin);
+
+            for (size_t i = 0; i < IR_BLOCK; i++) {
+                for (int c = 0; c < 2; c++) {
+                    const float v = plugin.out[c * IR_BLOCK + i];
+                    ir[4 * (pos + i) + 2 * side + c] = v;
+                    if (fabsf(v) > IR_SILENCE && len < pos + i + 1)
+                        len = pos + i + 1;
+                }
+            }
+        }
+        plugin_close(&plugin);
+    }
+
+    /* a uniformly partitioned convolver needs a complex MAC per bin, partition and path */
+    const size_t partitions = (len + IR_BLOCK - 1) / IR_BLOCK;
+    const double macs = 4.0 * (double)partitions * (IR_BLOCK + 1) / IR_BLOCK;
+    printf("%-6d %6d %3d %9.3f %10zu %12.0f\n", preset, rate, native, (double)len / rate, partitions, macs);
+
+    bool ok = true;
+    if (opt->ir_dir) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/ir-p%d-%d-n%d.raw", opt->ir_dir, preset, rate, native);
+        FILE *file = fopen(path, "wb");
+        if (!file || fwrite(ir, sizeof(float), 4 * len, file) != 4 * len) {
+            fprintf(stderr, "Could not write %s\n", path);
+            ok = false;
+        }
+        if (file)
+            fclose(file);
+    }
+    free(ir);
+    return ok;
+}
+
+/**
+   Run `opt->bank` instances as a bank and as single instances, each with a
+   noise source of its own.  The bank has to sound exactly like the single
+   instances, `bank_res->max_diff` is the largest difference between them.
+*/
+static bool
+bank_case(const Options *opt, int preset, int rate, int block, Signal signal, Result *bank_res, Result *single_res)
+{
+    const uint32_t count = (uint32_t)opt->bank;
+    const size_t bank_size = psx_reverb_bank_size(count, rate);
+    const size_t single_size = psx_reverb_size(PSX_REVERB_STEREO, rate);
+    void *bank_mem = malloc(bank_size);
+    void *single_mem = calloc(count, single_size);
+    float *buffers = calloc(6 * (size_t)count * block, sizeof(float));
+    float *in[2 * PSX_REVERB_BANK_MAX];
+    float *bank_out[2 * PSX_REVERB_BANK_MAX];
+    float *single_out[2 * PSX_REVERB_BANK_MAX];
+    PsxReverb *single[PSX_REVERB_BANK_MAX];
+    uint32_t states[PSX_REVERB_BANK_MAX];
+    bool ok = false;
+
+    PsxReverbBank *bank = bank_mem ? psx_reverb_bank_init(bank_mem, bank_size, count, rate) : NULL;
+    if (!bank || !single_mem || !buffers) {
+        fprintf(stderr, "Could not set up a bank of %u at %d Hz\n", count, rate);
+        goto out;
+    }
+    psx_reverb_bank_set_preset(bank, preset);
+    psx_reverb_bank_set_levels(bank, opt->wet, 0.0f, 0.0f);
+    for (uint32_t j = 0; j < count; j++) {
+        single[j] = psx_reverb_init((uint8_t *)single_mem + j * single_size, single_size, PSX_REVERB_STEREO, rate);
+        psx_reverb_set_preset(single[j], preset);
+        psx_reverb_set_levels(single[j], opt->wet, 0.0f, 0.0f);
+        states[j] = j + 1;
+        for (uint32_t c = 0; c < 2; c++) {
+            in[2 * j + c] = buffers + (2 * j + c) * (size_t)block;
+            bank_out[2 * j + c] = buffers + (2 * count + 2 * j + c) * (size_t)block;
+            single_out[2 * j + c] = buffers + (4 * count + 2 * j + c) * (size_t)block;
+        }
+    }
+
+    const uint64_t total = (uint64_t)(opt->seconds * rate);
+    uint64_t bank_ns = 0, single_ns = 0;
+    float max_diff = 0.0f;
+    for (uint64_t pos = 0; pos < total; pos += block) {
+        for (uint32_t j = 0; j < count; j++)
+            signal_fill(signal, pos, rate, &states[j], in[2 * j], in[2 * j + 1], block);
+
+        const uint64_t start = now_ns();
+        psx_reverb_bank_process(bank, (const float *const *)in, bank_out, block);
+        const uint64_t mid = now_ns();
+        for (uint32_t j = 0; j < count; j++)
+            psx_reverb_process(single[j], (const float *const *)&in[2 * j], &single_out[2 * j], block);
+        const uint64_t stop = now_ns();
+
+        bank_ns += mid - start;
+        single_ns += stop - mid;
+        for (size_t i = 0; i < 2 * (size_t)count * block; i++) {
+            const float diff = fabsf(bank_out[0][i] - single_out[0][i]);
+            if (!(diff <= max_diff))
+                max_diff = diff;
+        }
+    }
+
+    /* per sample of one instance, so both compare with a single plugin */
+    const double samples = (double)total * count;
+    memset(bank_res, 0, sizeof(*bank_res));
+    memset(single_res, 0, sizeof(*single_res));
+    bank_res->samples = single_res->samples = total;
+    bank_res->ns_per_sample = samples > 0.0 ? (double)bank_ns / samples : 0.0;
+    single_res->ns_per_sample = samples > 0.0 ? (double)single_ns / samples : 0.0;
+    bank_res->max_diff = max_diff;
+    ok = true;
+
+out:
+    free(buffers);
+    free(single_mem);
+    free(bank_mem);
+    return ok;
+}
+
+static bool
+list_parse(List *list, const char *arg)
+{
+    char *end;
+
+    list->count = 0;
+    while (*arg) {
+        if (list->count == LIST_MAX)
+            return false;
+        list->values[list->count++] = (int)strtol(arg, &end, 10);
+        if (end == arg || (*end && *end != ','))
+            return false;
+        arg = *end ? end + 1 : end;
+    }
+    return list->count > 0;
+}
+
+static void
+list_set(List *list, const int *values, int count)
+{
+    memcpy(list->values, values, count * sizeof(int));
+    list->count = count;
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -p LIST   presets (default 0-9)\n"
+            "  -r LIST   samplerates (default 44100,48000,96000,192000)\n"
+            "  -b LIST   block sizes (default 32,64,256,1024)\n"
+            "  -e LIST   engines: 0 shared, 1 delay lines, 2 fixed point, 3 eco (default 0)\n"
+            "  -n LIST   SPU rate off/on (default 0)\n"
+            "  -s SEC    seconds of audio per case (default 2)\n"
+            "  -W DB     wet level (default 0)\n"
+            "  -x        run without the worker feature\n"
+            "  -w DIR    write the output of each case as reference to DIR\n"
+            "  -g DIR    compare the output of each case to the reference in DIR\n"
+            "  -t TOL    largest allowed difference to the reference (default 0)\n"
+            "  -i DIR    render the impulse responses of the presets to DIR instead\n"
+            "  -l SEC    longest impulse response (default 20)\n"
+            "  -k COUNT  compare COUNT reverbs run as a bank with single instances instead\n",
+            name);
+}
+
+int
+main(int argc, char **argv)
+{
+    static const int default_presets[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+    static const int default_rates[] = { 44100, 48000, 96000, 192000 };
+    static const int default_blocks[] = { 32, 64, 256, 1024 };
+    static const int default_zero[] = { 0 };
+
+    Options opt;
+    memset(&opt, 0, sizeof(opt));
+    list_set(&opt.presets, default_presets, 10);
+    list_set(&opt.rates, default_rates, 4);
+    list_set(&opt.blocks, default_blocks, 4);
+    list_set(&opt.engines, default_zero, 1);
+    list_set(&opt.natives, default_zero, 1);
+    opt.seconds = 2.0;
+    opt.worker = true;
+    opt.ir_seconds = 20.0;
+
+    int c;
+    while ((c = getopt(argc, argv, "p:r:b:e:n:s:W:xw:g:t:i:l:k:h")) != -1) {
+        bool ok = true;
+        switch (c) {
+        case 'p': ok = list_parse(&opt.presets, optarg); break;
+        case 'r': ok = list_parse(&opt.rates, optarg); break;
+        case 'b': ok = list_parse(&opt.blocks, optarg); break;
+        case 'e': ok = list_parse(&opt.engines, optarg); break;
+        case 'n': ok = list_parse(&opt.natives, optarg); break;
+        case 's': opt.seconds = atof(optarg); break;
+        case 'W': opt.wet = (float)atof(optarg); break;
+        case 'x': opt.worker = false; break;
+        case 'w': opt.write_dir = optarg; break;
+        case 'g': opt.golden_dir = optarg; break;
+        case 't': opt.tolerance = (float)atof(optarg); break;
+        case 'i': opt.ir_dir = optarg; break;
+        case 'l': opt.ir_seconds = atof(optarg); break;
+        case 'k': opt.bank = atoi(optarg); ok = opt.bank >= 1 && opt.bank <= PSX_REVERB_BANK_MAX; break;
+        default: ok = false; break;
+        }
+        if (!ok) {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    /* the reference files don't name the engine, so they can be compared across engines */
+    if (opt.write_dir && opt.engines.count != 1) {
+        fprintf(stderr, "Writing references needs a single engine\n");
+        return 2;
+    }
+
+    const LV2_Descriptor *desc = lv2_descriptor(0);
+    if (!desc)
+        return 1;
+
+    if (opt.ir_dir) {
+        int failed = 0;
+        printf("%-6s %6s %3s %9s %10s %12s\n", "preset", "rate", "spu", "length(s)", "partitions", "cmacs/smp");
+        for (int n = 0; n < opt.natives.count; n++)
+        for (int r = 0; r < opt.rates.count; r++)
+        for (int p = 0; p < opt.presets.count; p++) {
+            const int preset = opt.presets.values[p];
+            const int rate = opt.rates.values[r];
+            if (preset < 0 || preset >= NUM_PRESETS || rate <= 1)
+                continue;
+            failed += !ir_case(desc, &opt, preset, rate, opt.natives.values[n]);
+            fflush(stdout);
+        }
+        return failed ? 1 : 0;
+    }
+
+    if (opt.bank) {
+        int failed = 0;
+        printf("%-6s %6s %5s %5s %-7s %9s %9s %7s %10s\n", "preset", "rate", "block", "count", "signal",
+               "bank", "single", "speedup", "maxdiff");
+        for (int r = 0; r < opt.rates.count; r++)
+        for (int b = 0; b < opt.blocks.count; b++)
+        for (int p = 0; p < opt.presets.count; p++)
+        for (int s = 0; s < NUM_SIGNALS; s++) {
+            const int preset = opt.presets.values[p];
+            const int rate = opt.rates.values[r];
+            const int block = opt.blocks.values[b];
+            Result bank, single;
+
+            if (preset < 0 || preset >= NUM_PRESETS || rate <= 1 || block <= 0) {
+                fprintf(stderr, "Skipping invalid case: preset %d, %d Hz, block %d\n", preset, rate, block);
+                continue;
+            }
+            if (!bank_case(&opt, preset, rate, block, (Signal)s, &bank, &single)) {
+                failed++;
+                continue;
+            }
+            printf("%-6d %6d %5d %5d %-7s %9.2f %9.2f %6.2fx %10.3g%s\n", preset, rate, block, opt.bank,
+                   signal_names[s], bank.ns_per_sample, single.ns_per_sample,
+                   bank.ns_per_sample > 0.0 ? single.ns_per_sample / bank.ns_per_sample : 0.0,
+                   bank.max_diff, bank.max_diff > opt.tolerance ? "  FAIL" : "");
+            failed += bank.max_diff > opt.tolerance;
+            fflush(stdout);
+        }
+        if (failed)
+            fprintf(stderr, "%d case(s) failed\n", failed);
+        return failed ? 1 : 0;
+    }
+
+    printf("%-6s %6s %5s %3s %3s %-7s %9s %10s %6s %12s", "preset", "rate", "block", "eng", "spu",
+           "signal", "ns/smp", "worst(us)", "load", "misses/ksmp");
+    if (opt.golden_dir)
+        printf(" %10s", "maxdiff");
+    printf("\n");
+
+    int failed = 0;
+    for (int e = 0; e < opt.engines.count; e++)
+    for (int n = 0; n < opt.natives.count; n++)
+    for (int r = 0; r < opt.rates.count; r++)
+    for (int b = 0; b < opt.blocks.count; b++)
+    for (int p = 0; p < opt.presets.count; p++)
+    for (int s = 0; s < NUM_SIGNALS; s++) {
+        const int preset = opt.presets.values[p];
+        const int rate = opt.rates.values[r];
+        const int block = opt.blocks.values[b];
+        const int engine = opt.engines.values[e];
+        const int native = opt.natives.values[n];
+        Result res;
+
+        if (preset < 0 || preset >= NUM_PRESETS || rate <= 1 || block <= 0) {
+            fprintf(stderr, "Skipping invalid case: preset %d, %d Hz, block %d\n", preset, rate, block);
+            continue;
+        }
+        if (!bench_case(desc, &opt, preset, rate, block, engine, native, (Signal)s, &res)) {
+            failed++;
+            continue;
+        }
+
+        printf("%-6d %6d %5d %3d %3d %-7s %9.2f %10.2f %5.1f%%", preset, rate, block, engine, native,
+               signal_names[s], res.ns_per_sample, res.worst_block_us, 100.0 * res.worst_block_load);
+        if (res.misses >= 0)
+            printf(" %12.2f", res.samples ? 1000.0 * (double)res.misses / (double)res.samples : 0.0);
+        else
+            printf(" %12s", "-");
+        if (opt.golden_dir) {
+            if (res.golden_missing) {
+                printf(" %10s  FAIL", "missing");
+                failed++;
+            } else {
+                printf(" %10.3g%s", res.max_diff, res.max_diff > opt.tolerance ? "  FAIL" : "");
+                failed += res.max_diff > opt.tolerance;
+            }
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    if (failed)
+        fprintf(stderr, "%d case(s) failed\n", failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,761 @@
+/*
+  Copyright 2023 Michael Panzlaff <michael.panlaff@fau.de>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/**
+   Offline batch renderer for the PSX reverb plugin.
+
+   Every WAV file given on the command line is run through the reverb and
+   written to the output directory under the same name, in the same sample
+   format.  Stereo and 8 channel files use the plugin variant with the same
+   channels, mono files the "Mono In" variant and come out in stereo.  Files
+   are spread over one thread per CPU, each with a plugin instance of its own
+   that is reused for the next file at the same rate.
+
+   The plugin is driven through its `LV2_Descriptor` like in psx-bench, with
+   the freewheeling port set, so the eco engine renders at full quality.
+   Inputs are mapped into memory and outputs written in large blocks.
+*/
+
+#define _GNU_SOURCE
+
+#include "lv2/core/lv2.h"
+#include "lv2/atom/atom.h"
+#include "lv2/atom/util.h"
+#include "lv2/log/log.h"
+#include "lv2/patch/patch.h"
+#include "lv2/urid/urid.h"
+#include "lv2/worker/worker.h"
+
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PSX_REV_URI "http://github.com/ipatix/lv2-psx-reverb"
+
+/* controls of all variants follow the audio ports in this order, see psx-reverb.ttl */
+enum {
+    PORT_WET = 0,
+    PORT_DRY,
+    PORT_PRESET,
+    PORT_MASTER,
+    PORT_AUDIO,
+};
+
+enum {
+    CTL_NATIVE = 0,
+    CTL_ENGINE,
+    CTL_CONTROL,
+    CTL_CROSSFADE,
+    CTL_THREADS,    // only in the 8 channel variant
+};
+
+/* outputs between the crossfade and the freewheeling port, they are left unconnected */
+#define NUM_REPORT_PORTS 6
+
+#define NUM_PRESETS 10
+#define CHANNELS_MAX 8
+#define URIS_MAX 64
+#define WORK_MAX 16
+#define WORK_SIZE 2048
+#define CONTROL_SIZE 2048
+
+typedef struct {
+    int preset;
+    float wet;
+    float dry;
+    float master;
+    int engine;
+    int native;
+    const char *registers;      // absolute path of a register dump or NULL
+    uint32_t block;
+    double tail;
+    int jobs;
+    const char *out_dir;
+    char **files;
+    int n_files;
+} Options;
+
+/* a minimal host: URID map, log and a worker that runs between two `run()` calls */
+typedef struct {
+    char *uris[URIS_MAX];
+    uint32_t n_uris;
+
+    uint8_t work[WORK_MAX][WORK_SIZE];
+    uint32_t work_size[WORK_MAX];
+    uint32_t n_work;
+    uint8_t responses[WORK_MAX][WORK_SIZE];
+    uint32_t response_size[WORK_MAX];
+    uint32_t n_responses;
+} Host;
+
+static LV2_URID
+host_map(LV2_URID_Map_Handle handle, const char *uri)
+{
+    Host *host = (Host *)handle;
+
+    for (uint32_t i = 0; i < host->n_uris; i++) {
+        if (!strcmp(host->uris[i], uri))
+            return i + 1;
+    }
+    if (host->n_uris == URIS_MAX)
+        return 0;
+    host->uris[host->n_uris] = strdup(uri);
+    return ++host->n_uris;
+}
+
+/* the plugin traces its load every second, only errors and warnings are of interest here */
+static int
+host_vprintf(LV2_Log_Handle handle, LV2_URID type, const char *fmt, va_list ap)
+{
+    if (type == host_map(handle, LV2_LOG__Trace))
+        return 0;
+    return vfprintf(stderr, fmt, ap);
+}
+
+static int
+host_printf(LV2_Log_Handle handle, LV2_URID type, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    const int ret = host_vprintf(handle, type, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+static LV2_Worker_Status
+host_schedule(LV2_Worker_Schedule_Handle handle, uint32_t size, const void *data)
+{
+    Host *host = (Host *)handle;
+
+    if (host->n_work == WORK_MAX || size > WORK_SIZE)
+        return LV2_WORKER_ERR_NO_SPACE;
+    memcpy(host->work[host->n_work], data, size);
+    host->work_size[host->n_work++] = size;
+    return LV2_WORKER_SUCCESS;
+}
+
+static LV2_Worker_Status
+host_respond(LV2_Worker_Respond_Handle handle, uint32_t size, const void *data)
+{
+    Host *host = (Host *)handle;
+
+    if (host->n_responses == WORK_MAX || size > WORK_SIZE)
+        return LV2_WORKER_ERR_NO_SPACE;
+    memcpy(host->responses[host->n_responses], data, size);
+    host->response_size[host->n_responses++] = size;
+    return LV2_WORKER_SUCCESS;
+}
+
+static void
+host_run_worker(Host *host, LV2_Handle instance, const LV2_Worker_Interface *iface)
+{
+    for (uint32_t i = 0; i < host->n_work; i++)
+        iface->work(instance, host_respond, host, host->work_size[i], host->work[i]);
+    host->n_work = 0;
+    for (uint32_t i = 0; i < host->n_responses; i++)
+        iface->work_response(instance, host->response_size[i], host->responses[i]);
+    host->n_responses = 0;
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* PCM and float WAV files, mapped into memory */
+enum { WAV_PCM = 1, WAV_FLOAT = 3, WAV_EXTENSIBLE = 0xFFFE };
+
+typedef struct {
+    void          *map;
+    size_t         map_size;
+    const uint8_t *data;
+    uint64_t       frames;
+    uint32_t       channels;
+    uint32_t       rate;
+    uint32_t       format;      // WAV_PCM or WAV_FLOAT
+    uint32_t       bits;
+} Wav;
+
+static uint32_t
+le16(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8;
+}
+
+static uint32_t
+le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void
+put16(uint8_t *p, uint32_t x)
+{
+    p[0] = (uint8_t)x;
+    p[1] = (uint8_t)(x >> 8);
+}
+
+static void
+put32(uint8_t *p, uint32_t x)
+{
+    put16(p, x);
+    put16(p + 2, x >> 16);
+}
+
+static void
+wav_close(Wav *wav)
+{
+    if (wav->map)
+        munmap(wav->map, wav->map_size);
+    memset(wav, 0, sizeof(*wav));
+}
+
+static bool
+wav_open(Wav *wav, const char *path)
+{
+    memset(wav, 0, sizeof(*wav));
+
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "%s: Could not open the file\n", path);
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    if (st.st_size < 12) {
+        fprintf(stderr, "%s: Not a WAV file\n", path);
+        close(fd);
+        return false;
+    }
+    wav->map_size = (size_t)st.st_size;
+    wav->map = mmap(NULL, wav->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (wav->map == MAP_FAILED) {
+        wav->map = NULL;
+        fprintf(stderr, "%s: Could not map the file\n", path);
+        return false;
+    }
+    madvise(wav->map, wav->map_size, MADV_SEQUENTIAL);
+
+    const uint8_t *p = (const uint8_t *)wav->map;
+    const uint8_t *end = p + wav->map_size;
+    if (memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4)) {
+        fprintf(stderr, "%s: Not a WAV file\n", path);
+        wav_close(wav);
+        return false;
+    }
+
+    uint32_t align = 0;
+    for (p += 12; end - p >= 8; ) {
+        const uint32_t size = le32(p + 4);
+        const uint8_t *body = p + 8;
+        const uint64_t avail = (uint64_t)(end - body);
+
+        if (!memcmp(p, "fmt ", 4) && size >= 16 && avail >= size) {
+            wav->format = le16(body);
+            wav->channels = le16(body + 2);
+            wav->rate = le32(body + 4);
+            align = le16(body + 12);
+            wav->bits = le16(body + 14);
+            if (wav->format == WAV_EXTENSIBLE && size >= 40)
+                wav->format = le16(body + 24);
+        } else if (!memcmp(p, "data", 4)) {
+            /* a stream that was never finished may have a wrong size, take what is there */
+            wav->data = body;
+            wav->frames = align ? (size < avail ? size : avail) / align : 0;
+            break;
+        }
+        if (avail < size)
+            break;
+        p = body + size + (size & 1);
+    }
+
+    const bool pcm = wav->format == WAV_PCM && (wav->bits == 16 || wav->bits == 24 || wav->bits == 32);
+    const bool flt = wav->format == WAV_FLOAT && wav->bits == 32;
+    if (!wav->data || !(pcm || flt) || align != wav->channels * wav->bits / 8 || wav->rate <= 1) {
+        fprintf(stderr, "%s: Only 16, 24 and 32 bit PCM and 32 bit float WAV files are supported\n", path);
+        wav_close(wav);
+        return false;
+    }
+    if (wav->channels != 1 && wav->channels != 2 && wav->channels != CHANNELS_MAX) {
+        fprintf(stderr, "%s: %u channels are not supported, only 1, 2 and 8\n", path, wav->channels);
+        wav_close(wav);
+        return false;
+    }
+    return true;
+}
+
+/* a canonical 44 byte header, the sizes are filled in by wav_finish() */
+static void
+wav_header(uint8_t *h, const Wav *wav, uint64_t frames)
+{
+    const uint32_t align = wav->channels * wav->bits / 8;
+    const uint64_t data = frames * align;
+    const uint32_t size = data > UINT32_MAX - 36 ? UINT32_MAX : (uint32_t)data;
+
+    memcpy(h, "RIFF", 4);
+    put32(h + 4, size + 36 > size ? size + 36 : UINT32_MAX);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put32(h + 16, 16);
+    put16(h + 20, wav->format);
+    put16(h + 22, wav->channels);
+    put32(h + 24, wav->rate);
+    put32(h + 28, wav->rate * align);
+    put16(h + 32, align);
+    put16(h + 34, wav->bits);
+    memcpy(h + 36, "data", 4);
+    put32(h + 40, size);
+}
+
+/* deinterleave `n` frames from `frame` on into float channels */
+static void
+wav_read(const Wav *wav, uint64_t frame, uint32_t n, float **out)
+{
+    const uint32_t bytes = wav->bits / 8;
+    const uint8_t *p = wav->data + frame * wav->channels * bytes;
+
+    for (uint32_t i = 0; i < n; i++) {
+        for (uint32_t c = 0; c < wav->channels; c++, p += bytes) {
+            float x;
+            if (wav->format == WAV_FLOAT) {
+                const uint32_t u = le32(p);
+                memcpy(&x, &u, sizeof(x));
+            } else if (bytes == 2) {
+                x = (float)(int16_t)le16(p) * (1.0f / 32768.0f);
+            } else if (bytes == 3) {
+                x = (float)((int32_t)(le32(p - 1) & 0xFFFFFF00u) >> 8) * (1.0f / 8388608.0f);
+            } else {
+                x = (float)((double)(int32_t)le32(p) * (1.0 / 2147483648.0));
+            }
+            out[c][i] = x;
+        }
+    }
+}
+
+/* interleave float channels into `dst` in the format of `wav`, PCM is rounded and clipped */
+static void
+wav_write(const Wav *wav, float *const *in, uint32_t n, uint8_t *dst)
+{
+    const uint32_t bytes = wav->bits / 8;
+    const double scale = ldexp(1.0, (int)wav->bits - 1);
+
+    for (uint32_t i = 0; i < n; i++) {
+        for (uint32_t c = 0; c < wav->channels; c++, dst += bytes) {
+            const float x = in[c][i];
+            if (wav->format == WAV_FLOAT) {
+                uint32_t u;
+                memcpy(&u, &x, sizeof(u));
+                put32(dst, u);
+                continue;
+            }
+            double v = floor((double)x * scale + 0.5);
+            if (!(v < scale - 1.0))
+                v = scale - 1.0;
+            if (!(v > -scale))
+                v = -scale;
+            const uint32_t u = (uint32_t)(int32_t)v;
+            dst[0] = (uint8_t)u;
+            dst[1] = (uint8_t)(u >> 8);
+            if (bytes > 2)
+                dst[2] = (uint8_t)(u >> 16);
+            if (bytes > 3)
+                dst[3] = (uint8_t)(u >> 24);
+        }
+    }
+}
+
+/* a plugin instance with its host, ports and features, one per thread */
+typedef struct {
+    const LV2_Descriptor       *desc;
+    LV2_Handle                  instance;
+    const LV2_Worker_Interface *iface;
+    Host                        host;
+    LV2_URID_Map                map;
+    LV2_Log_Log                 log;
+    LV2_Worker_Schedule         schedule;
+    LV2_Feature                 features[3];
+    const LV2_Feature          *feature_list[4];
+    uint32_t                    rate;
+    uint32_t                    channels;
+    uint32_t                    outputs;
+    uint32_t                    block;
+    float                       ctl[PORT_AUDIO];
+    float                       native;
+    float                       engine;
+    float                       crossfade;
+    float                       threads;
+    float                       freewheel;
+    uint64_t                    control[CONTROL_SIZE / sizeof(uint64_t)];
+    float                      *in[CHANNELS_MAX];
+    float                      *out[CHANNELS_MAX];
+    uint8_t                    *bytes;      // interleaved output of a block
+} Plugin;
+
+static void
+plugin_close(Plugin *plugin)
+{
+    if (plugin->instance) {
+        plugin->desc->deactivate(plugin->instance);
+        plugin->desc->cleanup(plugin->instance);
+    }
+    for (uint32_t i = 0; i < plugin->host.n_uris; i++)
+        free(plugin->host.uris[i]);
+    for (uint32_t c = 0; c < CHANNELS_MAX; c++) {
+        free(plugin->in[c]);
+        free(plugin->out[c]);
+    }
+    free(plugin->bytes);
+    memset(plugin, 0, sizeof(*plugin));
+}
+
+/* empty the control port, or put a patch:Set of the register file at frame 0 */
+static void
+plugin_control(Plugin *plugin, const char *registers)
+{
+    LV2_Atom_Sequence *seq = (LV2_Atom_Sequence *)plugin->control;
+    LV2_URID_Map *map = &plugin->map;
+
+    memset(seq, 0, sizeof(*seq));
+    seq->atom.type = host_map(&plugin->host, LV2_ATOM__Sequence);
+    seq->atom.size = sizeof(seq->body);
+    if (!registers)
+        return;
+
+    const uint32_t len = (uint32_t)strlen(registers) + 1;
+    LV2_Atom_Event *ev = (LV2_Atom_Event *)(seq + 1);
+    LV2_Atom_Object *obj = (LV2_Atom_Object *)&ev->body;
+    LV2_Atom_Property_Body *prop = (LV2_Atom_Property_Body *)(obj + 1);
+    LV2_Atom_URID *key = (LV2_Atom_URID *)&prop->value;
+    LV2_Atom_Property_Body *value = (LV2_Atom_Property_Body *)((uint8_t *)prop + lv2_atom_pad_size(sizeof(*prop) + sizeof(key->body)));
+    char *path = (char *)(value + 1);
+    const uint32_t size = (uint32_t)(path + len - (char *)(obj + 1));
+
+    if (sizeof(*seq) + sizeof(*ev) + sizeof(*obj) + lv2_atom_pad_size(size) > CONTROL_SIZE)
+        return;
+    ev->time.frames = 0;
+    obj->atom.type = host_map(&plugin->host, LV2_ATOM__Object);
+    obj->atom.size = sizeof(obj->body) + size;
+    obj->body.id = 0;
+    obj->body.otype = map->map(map->handle, LV2_PATCH__Set);
+    prop->key = map->map(map->handle, LV2_PATCH__property);
+    prop->context = 0;
+    key->atom.type = map->map(map->handle, LV2_ATOM__URID);
+    key->atom.size = sizeof(key->body);
+    key->body = map->map(map->handle, PSX_REV_URI "#registerFile");
+    value->key = map->map(map->handle, LV2_PATCH__value);
+    value->context = 0;
+    value->value.type = map->map(map->handle, LV2_ATOM__Path);
+    value->value.size = len;
+    memcpy(path, registers, len);
+    seq->atom.size += sizeof(*ev) + lv2_atom_pad_size(obj->atom.size + sizeof(obj->atom));
+}
+
+/* run one block and the worker requests it made, like a host between two cycles */
+static void
+plugin_run(Plugin *plugin, uint32_t n)
+{
+    plugin->desc->run(plugin->instance, n);
+    host_run_worker(&plugin->host, plugin->instance, plugin->iface);
+    plugin_control(plugin, NULL);
+}
+
+/* instantiate the variant for `channels` at `rate` unless the last file had the same */
+static bool
+plugin_open(Plugin *plugin, const Options *opt, uint32_t channels, uint32_t rate)
+{
+    if (plugin->instance && plugin->channels == channels && plugin->rate == rate)
+        return true;
+    plugin_close(plugin);
+
+    const LV2_Descriptor *desc = lv2_descriptor(channels == 1 ? 1 : channels == 2 ? 0 : 2);
+    if (!desc)
+        return false;
+    plugin->desc = desc;
+    plugin->rate = rate;
+    plugin->channels = channels;
+    plugin->outputs = channels == 1 ? 2 : channels;
+    plugin->block = opt->block;
+    plugin->map = (LV2_URID_Map){ &plugin->host, host_map };
+    plugin->log = (LV2_Log_Log){ &plugin->host, host_printf, host_vprintf };
+    plugin->schedule = (LV2_Worker_Schedule){ &plugin->host, host_schedule };
+    plugin->features[0] = (LV2_Feature){ LV2_URID__map, &plugin->map };
+    plugin->features[1] = (LV2_Feature){ LV2_LOG__log, &plugin->log };
+    plugin->features[2] = (LV2_Feature){ LV2_WORKER__schedule, &plugin->schedule };
+    for (uint32_t i = 0; i < 3; i++)
+        plugin->feature_list[i] = &plugin->features[i];
+
+    bool ok = (plugin->bytes = malloc((size_t)opt->block * plugin->outputs * sizeof(float))) != NULL;
+    for (uint32_t c = 0; c < channels; c++)
+        ok = ok && (plugin->in[c] = calloc(opt->block, sizeof(float))) != NULL;
+    for (uint32_t c = 0; c < plugin->outputs; c++)
+        ok = ok && (plugin->out[c] = calloc(opt->block, sizeof(float))) != NULL;
+    if (!ok) {
+        fprintf(stderr, "Could not allocate audio buffers\n");
+        plugin_close(plugin);
+        return false;
+    }
+
+    plugin->instance = desc->instantiate(desc, rate, ".", plugin->feature_list);
+    if (!plugin->instance) {
+        fprintf(stderr, "Could not instantiate the plugin at %u Hz\n", rate);
+        plugin_close(plugin);
+        return false;
+    }
+    plugin->iface = desc->extension_data(LV2_WORKER__interface);
+
+    uint32_t port = PORT_AUDIO;
+    for (uint32_t p = 0; p < PORT_AUDIO; p++)
+        desc->connect_port(plugin->instance, p, &plugin->ctl[p]);
+    for (uint32_t c = 0; c < channels; c++)
+        desc->connect_port(plugin->instance, port++, plugin->in[c]);
+    for (uint32_t c = 0; c < plugin->outputs; c++)
+        desc->connect_port(plugin->instance, port++, plugin->out[c]);
+    desc->connect_port(plugin->instance, port + CTL_NATIVE, &plugin->native);
+    desc->connect_port(plugin->instance, port + CTL_ENGINE, &plugin->engine);
+    desc->connect_port(plugin->instance, port + CTL_CONTROL, plugin->control);
+    desc->connect_port(plugin->instance, port + CTL_CROSSFADE, &plugin->crossfade);
+    port += CTL_THREADS;
+    if (channels == CHANNELS_MAX)
+        desc->connect_port(plugin->instance, port++, &plugin->threads);
+    desc->connect_port(plugin->instance, port + NUM_REPORT_PORTS, &plugin->freewheel);
+    return true;
+}
+
+/**
+   Reset the instance for a new file.  The preset, engine and custom registers
+   are switched to and the gains settle on a second of silence first, so the
+   file is rendered as if the controls had been set all along.
+*/
+static void
+plugin_start(Plugin *plugin, const Options *opt)
+{
+    plugin->desc->deactivate(plugin->instance);
+    plugin->desc->activate(plugin->instance);
+
+    plugin->ctl[PORT_WET] = opt->wet;
+    plugin->ctl[PORT_DRY] = opt->dry;
+    plugin->ctl[PORT_PRESET] = (float)opt->preset;
+    plugin->ctl[PORT_MASTER] = opt->master;
+    plugin->native = (float)opt->native;
+    plugin->engine = (float)opt->engine;
+    plugin->crossfade = 0.0f;
+    plugin->threads = 0.0f;
+    plugin->freewheel = 1.0f;
+
+    for (uint32_t c = 0; c < plugin->channels; c++)
+        memset(plugin->in[c], 0, plugin->block * sizeof(float));
+    plugin_control(plugin, opt->registers);
+    for (uint64_t pos = 0; pos < plugin->rate; pos += plugin->block)
+        plugin_run(plugin, plugin->block);
+}
+
+static bool
+render_file(Plugin *plugin, const Options *opt, const char *in_path)
+{
+    const char *name = strrchr(in_path, '/');
+    char out_path[PATH_MAX];
+    Wav wav;
+
+    snprintf(out_path, sizeof(out_path), "%s/%s", opt->out_dir, name ? name + 1 : in_path);
+    if (!wav_open(&wav, in_path))
+        return false;
+    if (!plugin_open(plugin, opt, wav.channels, wav.rate)) {
+        wav_close(&wav);
+        return false;
+    }
+
+    /* never write over the input, e.g. with the input's directory as output */
+    struct stat in_st, out_st;
+    if (stat(in_path, &in_st) == 0 && stat(out_path, &out_st) == 0 &&
+        in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+        fprintf(stderr, "%s: The output would overwrite the input\n", in_path);
+        wav_close(&wav);
+        return false;
+    }
+
+    FILE *out = fopen(out_path, "wb");
+    if (!out) {
+        fprintf(stderr, "%s: Could not write %s\n", in_path, out_path);
+        wav_close(&wav);
+        return false;
+    }
+    setvbuf(out, NULL, _IOFBF, (size_t)4 << 20);
+
+    const uint64_t start = now_ns();
+    const uint64_t frames = wav.frames + (uint64_t)(opt->tail * wav.rate);
+    Wav format = wav;
+    format.channels = plugin->outputs;
+    const uint32_t frame_bytes = format.channels * format.bits / 8;
+    uint8_t header[44];
+    bool ok = true;
+
+    plugin_start(plugin, opt);
+    wav_header(header, &format, frames);
+    ok = fwrite(header, sizeof(header), 1, out) == 1;
+    for (uint64_t pos = 0; ok && pos < frames; pos += plugin->block) {
+        const uint32_t n = frames - pos < plugin->block ? (uint32_t)(frames - pos) : plugin->block;
+        const uint32_t m = pos >= wav.frames ? 0 : wav.frames - pos < n ? (uint32_t)(wav.frames - pos) : n;
+
+        /* the tail is rendered from silence */
+        wav_read(&wav, pos, m, plugin->in);
+        for (uint32_t c = 0; c < wav.channels; c++)
+            memset(plugin->in[c] + m, 0, (n - m) * sizeof(float));
+        plugin_run(plugin, n);
+        wav_write(&format, plugin->out, n, plugin->bytes);
+        ok = fwrite(plugin->bytes, frame_bytes, n, out) == n;
+    }
+    if (fclose(out) != 0 || !ok) {
+        fprintf(stderr, "%s: Could not write %s\n", in_path, out_path);
+        ok = false;
+    }
+
+    if (ok) {
+        const double seconds = (double)(now_ns() - start) * 1e-9;
+        printf("%s -> %s: %.1f s of audio in %.2f s\n", in_path, out_path, (double)frames / wav.rate, seconds);
+    }
+    wav_close(&wav);
+    return ok;
+}
+
+/* the files are claimed one at a time, so the threads stay busy until all are done */
+typedef struct {
+    const Options *opt;
+    int            next;
+    int            failed;
+} Batch;
+
+static void *
+render_thread(void *data)
+{
+    Batch *batch = (Batch *)data;
+    Plugin *plugin = calloc(1, sizeof(Plugin));
+
+    if (!plugin) {
+        __atomic_fetch_add(&batch->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    for (;;) {
+        const int i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+        if (i >= batch->opt->n_files)
+            break;
+        if (!render_file(plugin, batch->opt, batch->opt->files[i]))
+            __atomic_fetch_add(&batch->failed, 1, __ATOMIC_RELAXED);
+    }
+    plugin_close(plugin);
+    free(plugin);
+    return NULL;
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options] -o DIR FILE.wav...\n"
+            "  -o DIR    directory the output files are written to under the input's name\n"
+            "  -p N      preset (default 0)\n"
+            "  -W DB     wet level (default 0)\n"
+            "  -D DB     dry level (default 0)\n"
+            "  -M DB     master level (default 0)\n"
+            "  -e N      engine: 0 shared, 1 delay lines, 2 fixed point, 3 eco (renders as 0) (default 0)\n"
+            "  -n        run the reverb at SPU rate\n"
+            "  -c FILE   custom preset from a register dump, see README.md\n"
+            "  -t SEC    render this much of the reverb tail after the end of each file (default 0)\n"
+            "  -b N      block size in frames (default 16384)\n"
+            "  -j N      files rendered in parallel (default: one per CPU)\n",
+            name);
+}
+
+int
+main(int argc, char **argv)
+{
+    static char registers[PATH_MAX];
+    Options opt;
+
+    memset(&opt, 0, sizeof(opt));
+    opt.block = 16384;
+    opt.jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    int c;
+    while ((c = getopt(argc, argv, "o:p:W:D:M:e:nc:t:b:j:h")) != -1) {
+        bool ok = true;
+        switch (c) {
+        case 'o': opt.out_dir = optarg; break;
+        case 'p': opt.preset = atoi(optarg); ok = opt.preset >= 0 && opt.preset < NUM_PRESETS; break;
+        case 'W': opt.wet = (float)atof(optarg); break;
+        case 'D': opt.dry = (float)atof(optarg); break;
+        case 'M': opt.master = (float)atof(optarg); break;
+        case 'e': opt.engine = atoi(optarg); break;
+        case 'n': opt.native = 1; break;
+        case 'c':
+            /* the plugin takes paths up to 1 KiB */
+            ok = realpath(optarg, registers) != NULL && strlen(registers) < 1024;
+            opt.registers = registers;
+            if (!ok)
+                fprintf(stderr, "%s: Could not find the register file\n", optarg);
+            break;
+        case 't': opt.tail = atof(optarg); ok = opt.tail >= 0.0; break;
+        case 'b': opt.block = (uint32_t)atoi(optarg); ok = opt.block > 0; break;
+        case 'j': opt.jobs = atoi(optarg); ok = opt.jobs > 0; break;
+        default: ok = false; break;
+        }
+        if (!ok) {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    opt.files = argv + optind;
+    opt.n_files = argc - optind;
+    if (!opt.out_dir || opt.n_files == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (opt.jobs < 1)
+        opt.jobs = 1;
+    if (opt.jobs > opt.n_files)
+        opt.jobs = opt.n_files;
+
+    Batch batch = { &opt, 0, 0 };
+    pthread_t *threads = calloc(opt.jobs, sizeof(pthread_t));
+    int started = 0;
+    if (threads) {
+        while (started < opt.jobs && pthread_create(&threads[started], NULL, render_thread, &batch) == 0)
+            started++;
+    }
+    if (started == 0)
+        render_thread(&batch);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    if (batch.failed)
+        fprintf(stderr, "%d file(s) failed\n", batch.failed);
+    return batch.failed ? 1 : 0;
+}
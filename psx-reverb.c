@@ -27,6 +27,15 @@
 #include "lv2/core/lv2_util.h"
 #include "lv2/log/log.h"
 #include "lv2/log/logger.h"
+#include "lv2/options/options.h"
+#include "lv2/parameters/parameters.h"
+#include "lv2/atom/atom.h"
+#include "lv2/atom/util.h"
+#include "lv2/patch/patch.h"
+#include "lv2/state/state.h"
+#include "lv2/worker/worker.h"
+
+#include "psx-reverb.h"
 
 /** Include standard C headers */
 #include <math.h>
@@ -36,6 +45,60 @@
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <time.h>
+
+/**
+   Building with `PSX_REV_SIMD` defined enables the stereo kernel that keeps
+   the left and right reverb lanes in one SSE2/NEON register.  The scalar
+   kernel stays the reference and is used on all other targets.
+*/
+#if defined(PSX_REV_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#include <emmintrin.h>
+#define PSX_REV_SIMD_SSE2
+#elif defined(PSX_REV_SIMD) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PSX_REV_SIMD_NEON
+#else
+#undef PSX_REV_SIMD
+#endif
+
+/* sharing presets between instances and saving the reverb tail need atomics */
+#if defined(__GNUC__)
+#define PSX_REV_ATOMICS
+#endif
+
+/* the kernels are specialized per topology by inlining them with a constant, see PSX_REV_TOPOLOGIES */
+#if defined(__GNUC__)
+#define PSX_REV_INLINE inline __attribute__((always_inline))
+#else
+#define PSX_REV_INLINE inline
+#endif
+
+/* the 8 channel variant can run its networks on threads of its own, see pool_open() */
+#if defined(__linux__) && defined(PSX_REV_ATOMICS)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#define PSX_REV_THREADS
+#endif
+
+/* building with `PSX_REV_ARENA` puts each instance into one locked mapping, see arena_open() */
+#if defined(PSX_REV_ARENA) && defined(__linux__)
+#include <sys/mman.h>
+#else
+#undef PSX_REV_ARENA
+#endif
+
+/* the floating point environment is set to flush denormals in run() */
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define PSX_REV_FTZ_SSE
+#elif defined(__aarch64__)
+#define PSX_REV_FTZ_AARCH64
+#endif
 
 /**
    The URI is the identifier for a plugin, and how the host associates this
@@ -45,6 +108,8 @@
    in the data files, the host will fail to load the plugin.
 */
 #define PSX_REV_URI "http://github.com/ipatix/lv2-psx-reverb"
+#define PSX_REV_URI_MONO PSX_REV_URI "/mono"
+#define PSX_REV_URI_8CH  PSX_REV_URI "/8ch"
 
 /**
    In code, ports are referred to by index.  An enumeration of port indices
@@ -59,8 +124,38 @@ typedef enum {
     PSX_REV_MAIN1_IN = 5,
     PSX_REV_MAIN0_OUT = 6,
     PSX_REV_MAIN1_OUT = 7,
+    PSX_REV_NATIVE = 8,
+    PSX_REV_ENGINE = 9,
+    PSX_REV_CONTROL = 10,
+    PSX_REV_CROSSFADE = 11,
+    PSX_REV_THREADS_PORT = 12,  // only the 8 channel variant has it
+    PSX_REV_LOAD = 13,          // the rest are outputs, see stats_end()
+    PSX_REV_LOAD_PEAK = 14,
+    PSX_REV_RELOADS = 15,
+    PSX_REV_RELOAD_TIME = 16,
+    PSX_REV_IDLE = 17,
+    PSX_REV_DENORMALS = 18,
+    PSX_REV_FREEWHEEL = 19,     // input, lv2:freeWheeling
 } PortIndex;
 
+/* implementations of the reverb network selectable with the engine port */
+typedef enum {
+    PSX_REV_ENGINE_SHARED = 0,  // one masked circular buffer like the SPU
+    PSX_REV_ENGINE_LINES = 1,   // separate delay line per written register
+    PSX_REV_ENGINE_FIXED = 2,   // 16 bit buffer and fixed point math like the SPU
+    PSX_REV_ENGINE_ECO = 3,     // shared buffer at a coarse rate, see PsxEco
+} PsxReverbEngine;
+
+#define NUM_ENGINES 4
+
+/* rates networks run at, the rows of the preset table, see network_row() */
+enum {
+    PSX_REV_RATE_HOST,
+    PSX_REV_RATE_SPU,
+    PSX_REV_RATE_ECO,
+    NUM_RATES
+};
+
 /**
    Every plugin defines a private structure for the plugin instance.  All data
    associated with a plugin instance is stored here, and is available to
@@ -71,38 +166,182 @@ typedef enum {
 #define NUM_PRESETS 10
 #define SPU_REV_RATE 22050
 #define SPU_REV_PRESET_LONGEST_COUNT (0x18040 / 2)
+#define SPU_REV_MEM_MAX 0x7F000     // SPU RAM above the capture buffers
+
+/* preset index of the custom registers sent to the control port */
+#define PSX_REV_PRESET_CUSTOM NUM_PRESETS
+
+/* longest path of a register file sent to the control port, including the terminator */
+#define PSX_REV_PATH_MAX 1024
+
+/* run() processes blocks in chunks of this many samples */
+#define PSX_REV_CHUNK 256
+
+/* per sample coefficient of the gain smoothing and where it counts as settled */
+#define PSX_REV_GAIN_SMOOTHING 0.001f
+#define PSX_REV_GAIN_EPSILON   1e-6f
+
+/* gains in the range of the ports come from a table in steps of 1/16 dB */
+#define PSX_REV_DB_MIN   -30
+#define PSX_REV_DB_MAX   12
+#define PSX_REV_DB_STEPS 16
+#define PSX_REV_DB_TABLE ((PSX_REV_DB_MAX - PSX_REV_DB_MIN) * PSX_REV_DB_STEPS + 1)
+
+/* alignment of the converted preset table */
+#define PSX_REV_CACHE_LINE 64
+#define PSX_REV_ALIGN(x) (((x) + PSX_REV_CACHE_LINE - 1) & ~(size_t)(PSX_REV_CACHE_LINE - 1))
+
+/* amount of SPU buffer cleared per run() when switching presets without worker */
+#define PSX_REV_CLEAR_CHUNK 0x4000
+
+/* longest crossfade between presets in ms */
+#define PSX_REV_CROSSFADE_MAX 2000.0f
+
+/* peak level (about -100 dB) below which input and reverb tail count as silent */
+#define PSX_REV_SILENCE 1e-5f
+
+/* polyphase resampler used for running the reverb at (close to) SPU rate */
+#define RESAMPLER_TAPS 16           // taps per polyphase branch
+#define RESAMPLER_FACTOR_MAX 16     // highest supported decimation factor
+#define RESAMPLER_LEN_MAX (RESAMPLER_TAPS * RESAMPLER_FACTOR_MAX)
 
 typedef struct {
-    // lv2 stuff
-    LV2_URID_Map*  map;     // URID map feature
-    LV2_Log_Logger logger;  // Logger API      
+    uint32_t factor;                // decimation factor, 1 = disabled
+    uint32_t phase_in;              // host samples since the last SPU sample
+    uint32_t phase_out;
+    uint32_t pos_in;
+    uint32_t pos_out;
+    float    dec_coef[RESAMPLER_LEN_MAX];
+    float    int_coef[RESAMPLER_FACTOR_MAX][RESAMPLER_TAPS];
+    /* histories are stored twice in a row so the filters can read them linearly */
+    float    hist_in[2][2 * RESAMPLER_LEN_MAX];
+    float    hist_out[2][2 * RESAMPLER_TAPS];
+} PsxResampler;
 
-    // Port buffers
-    const float* port_wet;
-    const float* port_dry;
-    const float* port_preset;   // <-- this is technically an int
-    const float* port_master;
-    const float* port_main0_in;
-    const float* port_main1_in;
-    float*       port_main0_out;
-    float*       port_main1_out;
+/* the eco engine runs at the integer fraction of the host rate closest to this */
+#define PSX_REV_ECO_RATE 11025.0f
 
-    // processing state data
-    float        master;
-    float        wet;
-    int          preset;
-    float        dry;
+/* share of the comb gain below which the eco engine drops the DIFF cross-feed, see eco_reduce() */
+#define PSX_REV_ECO_DIFF 0.25f
 
-    float       *spu_buffer;
-    size_t       spu_buffer_count;
-    size_t       spu_buffer_count_mask;
+/**
+   Cheap decimation for the eco engine: each network sample is the mean of
+   `factor` host samples, and the output is interpolated linearly between the
+   last two network samples.  Both are linear phase and much cheaper than
+   PsxResampler, but they let through more aliasing and roll off the top.
+*/
+typedef struct {
+    uint32_t factor;
+    float    step;                  // 1 / factor
+    uint32_t phase_in;
+    uint32_t phase_out;
+    float    sum[2];
+    float    prev[2];
+    float    next[2];
+} PsxEco;
+
+/* one-pole smoothed gain, applied as a linear ramp per chunk while moving */
+typedef struct {
+    float db;       // last value set, by the port or an event
+    float port;     // last port value, events hold until it changes
+    float target;
+    float value;
+} PsxGain;
 
+/* state of one stereo reverb network, variants with more channels run several */
+typedef struct {
+    float       *buffer;            // this network's part of spu_buffer
     uint32_t     BufferAddress;
+    uint32_t     lines_time;        // samples run through the split engine
+    uint32_t     quiet;             // host samples input and output have been silent
+    PsxResampler resampler;
+    PsxEco       eco;
+} PsxReverbNetwork;
 
-    /* misc things */
-    float        rate;
+/* plugins in this library, they only differ in their audio ports */
+#define PSX_REV_PAIRS_MAX 4
+
+typedef struct {
+    const char *uri;
+    uint32_t    inputs;         // audio inputs, a mono input feeds both sides
+    uint32_t    pairs;          // stereo networks and output pairs
+    bool        threads;        // has PSX_REV_THREADS_PORT
+} PsxReverbVariant;
+
+/* the index is the one lv2_descriptor() is called with */
+static const PsxReverbVariant variants[] = {
+    { PSX_REV_URI,      2, 1, false },
+    { PSX_REV_URI_MONO, 1, 1, false },
+    { PSX_REV_URI_8CH,  8, 4, true },
+};
+
+#define NUM_VARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+/* delay lines of the split engine, one per register the network writes */
+enum {
+    LINE_LSAME, LINE_RSAME, LINE_LDIFF, LINE_RDIFF,
+    LINE_LAPF1, LINE_RAPF1, LINE_LAPF2, LINE_RAPF2,
+    NUM_LINES
+};
+
+/* reads of the network in the order spu_reverb_step() does them */
+enum {
+    READ_dLSAME, READ_mLSAME_PREV, READ_dRSAME, READ_mRSAME_PREV,
+    READ_dRDIFF, READ_mLDIFF_PREV, READ_dLDIFF, READ_mRDIFF_PREV,
+    READ_mLCOMB1, READ_mLCOMB2, READ_mLCOMB3, READ_mLCOMB4,
+    READ_mRCOMB1, READ_mRCOMB2, READ_mRCOMB3, READ_mRCOMB4,
+    READ_LAPF1_IN, READ_LAPF1_OUT, READ_RAPF1_IN, READ_RAPF1_OUT,
+    READ_LAPF2_IN, READ_LAPF2_OUT, READ_RAPF2_IN, READ_RAPF2_OUT,
+    NUM_READS
+};
+
+/**
+   Stages of the network a preset doesn't need, see topology_check().  The
+   kernels take these as a constant and are instantiated for every
+   combination of them, so sparse presets skip the taps and stages they
+   don't use.  A silent network doesn't run a kernel at all.
+*/
+#define PSX_REV_TOPO_DIFF   (1u << 0)   // nothing else reads the different side reflection
+#define PSX_REV_TOPO_COMB34 (1u << 1)   // vCOMB3 and vCOMB4 are 0
+#define PSX_REV_TOPO_COMB2  (1u << 2)   // vCOMB2 is 0
+#define PSX_REV_TOPO_APF    (1u << 3)   // vAPF1 and vAPF2 are 0, the APFs are plain delays
+#define PSX_REV_TOPO_SILENT (1u << 4)   // all comb gains are 0, the output is silence
+
+#define PSX_REV_TOPOLOGIES(X) \
+    X(0)  X(1)  X(2)  X(3)  X(4)  X(5)  X(6)  X(7) \
+    X(8)  X(9)  X(10) X(11) X(12) X(13) X(14) X(15)
+
+/**
+   Building with `PSX_REV_INTERLEAVE` interleaves the left and right line of
+   each register pair sample by sample.  The writes of a sample and reads of
+   both sides at the same age (the APF inputs, the previous reflection) then
+   share a cache line, which halves the streams the prefetcher has to follow.
+   It pays off when the lines don't stay in the cache, e.g. with many
+   instances at high rates, and costs vectorization of the staged spans
+   otherwise, so it is off by default.
+*/
+#ifdef PSX_REV_INTERLEAVE
+#define PSX_REV_LINES_STRIDE 2
+#else
+#define PSX_REV_LINES_STRIDE 1
+#endif
+
+/* lines shorter than this would split chunks into many short spans */
+#define PSX_REV_LINE_MIN (4 * PSX_REV_CHUNK)
+
+/* layout of the split engine in the buffer, see lines_layout() */
+typedef struct {
+    size_t   count;                 // buffer size all lines need together
+    uint32_t base[NUM_LINES];       // start of each line in the buffer
+    uint32_t mask[NUM_LINES];       // line sizes are powers of two
+    uint32_t age[NUM_READS];        // samples since the value read was written
+    uint8_t  line[NUM_READS];       // line the value read was written to
+    uint32_t staged_span;           // longest span that can run stage by stage
+} PsxReverbLines;
 
-    /* converted reverb parameters */
+/* reverb registers converted for the rate the network runs at */
+typedef struct {
+    size_t   buffer_count;  // SPU buffer size this preset needs
     uint32_t dAPF1;
     uint32_t dAPF2;
     float    vIIR;
@@ -135,11 +374,232 @@ typedef struct {
     uint32_t mRAPF2;
     float    vLIN;
     float    vRIN;
-} PsxReverb;
+
+    /* lanes of the vector kernel that alias, see simd_lanes_check() */
+    uint8_t  simd_fixup;
+    bool     simd_apf1;
+    bool     simd_apf2;
+
+    PsxReverbLines lines;
+    uint8_t  topology;      // PSX_REV_TOPO_* flags
+
+    /* gains of the fixed point engine as 1.15 */
+    struct {
+        int16_t vIIR;
+        int16_t vCOMB1;
+        int16_t vCOMB2;
+        int16_t vCOMB3;
+        int16_t vCOMB4;
+        int16_t vWALL;
+        int16_t vAPF1;
+        int16_t vAPF2;
+    } fixed;
+} PsxReverbParams;
+
+/* messages passed to the worker and back, the type comes first */
+typedef enum {
+    PSX_REV_WORK_SWITCH = 0,    // prepare the buffer for a preset switch
+    PSX_REV_WORK_CUSTOM = 1,    // convert custom registers
+    PSX_REV_WORK_FADE = 2,      // clear the networks a crossfade is done with
+    PSX_REV_WORK_POOL = 3,      // start the threads of the networks
+    PSX_REV_WORK_REPORT = 4,    // log what is in the stats ring
+} PsxReverbWorkType;
+
+typedef struct {
+    PsxReverbWorkType      type;
+    const PsxReverbParams *params;
+    PsxReverbEngine        engine;
+    float                 *buffer;
+    size_t                 buffer_count;
+    size_t                 buffer_dirty;
+} PsxReverbWork;
+
+/* the worker starts the pool and passes it back, it is NULL if that failed */
+typedef struct {
+    PsxReverbWorkType type;
+    struct PsxPool   *pool;
+} PsxReverbPoolWork;
+
+/* custom registers, read from `path` first unless it is empty */
+typedef struct {
+    PsxReverbWorkType type;
+    uint32_t          slot;     // parameter sets to convert into
+    bool              ok;       // set by the worker
+    uint16_t          registers[0x20];
+    char              path[PSX_REV_PATH_MAX];
+} PsxReverbCustomWork;
+
+/* state of the second set of networks crossfades run the old preset on */
+typedef enum {
+    PSX_REV_FADE_IDLE = 0,      // buffer is clear
+    PSX_REV_FADE_RUNNING = 1,   // old preset is faded out
+    PSX_REV_FADE_CLEARING = 2,  // run() clears the buffer
+    PSX_REV_FADE_WORKER = 3,    // the worker clears the buffer
+} PsxFadeState;
+
+/* load of one window of about a second, see stats_end() */
+typedef struct {
+    float    load;          // mean ns per sample
+    float    load_peak;     // ns per sample of the slowest block
+    uint32_t reloads;       // presets loaded since activate()
+    float    reload_time;   // ms spent on it in run() and activate()
+    bool     idle;          // all networks are skipped as silent
+} PsxStatsRecord;
+
+/* records for the worker to log, written by run() only */
+#define PSX_REV_STATS_RING 16
+
+typedef struct {
+    PsxStatsRecord last;            // the ports show this one
+    uint64_t       window_ns;
+    uint64_t       window_samples;
+    float          window_peak;
+    uint64_t       reload_ns;
+    PsxStatsRecord ring[PSX_REV_STATS_RING];
+    uint32_t       head;            // written by run()
+    uint32_t       tail;            // written by the worker
+} PsxStats;
+
+struct PsxReverb {
+    // lv2 stuff
+    const PsxReverbVariant *variant;
+    LV2_URID_Map*  map;     // URID map feature
+    LV2_Log_Logger logger;  // Logger API      
+    struct {
+        LV2_URID atom_Bool;
+        LV2_URID atom_Float;
+        LV2_URID atom_Int;
+        LV2_URID atom_Chunk;
+        LV2_URID atom_Path;
+        LV2_URID atom_URID;
+        LV2_URID atom_Vector;
+        LV2_URID atom_Object;
+        LV2_URID atom_Blank;
+        LV2_URID patch_Set;
+        LV2_URID patch_property;
+        LV2_URID patch_value;
+        LV2_URID param_sampleRate;
+        LV2_URID registers;
+        LV2_URID registerFile;
+        LV2_URID preset;
+        LV2_URID native;
+        LV2_URID engine;
+        LV2_URID wet;
+        LV2_URID dry;
+        LV2_URID master;
+        LV2_URID tail;
+        LV2_URID Tail;
+    } uris;
+
+    // Port buffers
+    const float* port_wet;
+    const float* port_dry;
+    const float* port_preset;   // <-- this is technically an int
+    const float* port_master;
+    const float* port_native;
+    const float* port_engine;
+    const LV2_Atom_Sequence* port_control;
+    const float* port_crossfade;
+    const float* port_threads;
+    float*       port_load;
+    float*       port_load_peak;
+    float*       port_reloads;
+    float*       port_reload_time;
+    float*       port_idle;
+    float*       port_denormals;
+    const float* port_freewheel;
+
+    /* buffers and controls of the block, run() takes them from the ports */
+    const float     *in[2 * PSX_REV_PAIRS_MAX];
+    float           *out[2 * PSX_REV_PAIRS_MAX];
+    PsxReverbEngine  engine_request;
+    bool             native_request;
+    bool             freewheel;     // the eco engine runs as the shared one
+    bool             threads;       // networks may run on the pool
+    float            crossfade;     // ms
+
+    // processing state data
+    PsxGain      master;
+    PsxGain      wet;
+    int          preset;        // preset in use or being switched to
+    int          preset_request;
+    float        preset_port;   // last port value, like PsxGain
+    PsxGain      dry;
+    float        gain_decay[PSX_REV_CHUNK + 1];  // one-pole decay after n samples
+    float        gain_db[PSX_REV_DB_TABLE];     // coefficient of each table step
+
+    float       *spu_buffer;            // buffers of all networks in a row
+    size_t       spu_buffer_count;      // per network
+    size_t       spu_buffer_count_mask;
+    size_t       spu_buffer_used;       // per network, part the engine in use reads and writes
+    size_t       spu_buffer_dirty;      // per network, only this part may not be clear
+    bool         spu_buffer_resize;     // worker sizes the buffer per preset
+
+    PsxReverbNetwork net[PSX_REV_PAIRS_MAX];
+    uint32_t     tail;                  // host samples a value stays in the network
+
+    PsxReverbEngine engine;             // engine in use or being switched to
+    PsxReverbEngine kernel;             // engine the buffer is laid out for
+
+    /* misc things */
+    float        rate;
+    bool         native;
+
+    /* converted reverb parameters, all presets for host rate and SPU rate */
+    const PsxReverbParams *params;
+    const PsxReverbParams (*param_table)[NUM_PRESETS];
+    void                  *param_table_mem;   // if not shared through table_cache
+    struct PsxTableSlot   *param_table_slot;  // if it is
+    size_t                 arena_size;        // mapping the instance is in, see arena_open()
+
+    /* preset switching, see preset_switch() */
+    LV2_Worker_Schedule   *schedule;
+    bool                   switching;    // spu_buffer is being cleared, don't touch it
+    const PsxReverbParams *pending;      // set while run() clears the buffer itself
+    size_t                 clear_pos;
+
+    /* custom presets from the control port, see control_read() */
+    PsxReverbParams        custom[2][NUM_RATES];    // two sets for all network rates
+    uint16_t               custom_registers[2][0x20];
+    uint32_t               custom_slot;             // set the custom preset uses
+    bool                   custom_selected;         // until the preset port changes
+    bool                   custom_busy;             // worker converts into the other set
+    bool                   custom_queued;           // custom_next waits for the worker
+    uint32_t               custom_next_size;
+    PsxReverbCustomWork    custom_next;
+
+    /* crossfaded preset switches, see fade_start() */
+    struct PsxReverb      *fade;            // only the network fields are used
+    PsxFadeState           fade_state;
+    uint32_t               fade_pos;
+    uint32_t               fade_len;
+    size_t                 fade_count;      // per network, fits all presets built in
+    size_t                 fade_clear_pos;
+
+    /* networks on threads of their own, see pool_run() */
+    struct PsxPool        *pool;
+    bool                   pool_requested;  // once, even if it failed
+
+    PsxStats               stats;
+
+    /* state, see state_save() */
+    bool                   saving;       // the tail is being copied, don't switch
+    bool                   restored;     // activate() keeps the restored state
+};
 
 static const uint16_t presets[10][0x20];
+static const uint32_t preset_mem_size[NUM_PRESETS];
+
+typedef struct PsxReverbPreset PsxReverbPreset;
 
 static void preset_load(PsxReverb *, int); 
+static void preset_convert(PsxReverbParams *, int, float);
+static void preset_convert_registers(PsxReverbParams *, const PsxReverbPreset *, uint32_t, float);
+static void eco_reduce(PsxReverbParams *);
+static uint32_t preset_size(const PsxReverbPreset *);
+static void fade_reset(PsxReverb *);
+static bool pool_late(PsxReverb *);
+static void pool_sync(PsxReverb *);
 
 static float avg(float a, float b) {
     return (a + b) / 2.0f;
@@ -186,259 +646,3735 @@ static uint32_t ceilpower2(uint32_t x) {
     return x;
 }
 
-/**
-   The `instantiate()` function is called by the host to create a new plugin
-   instance.  The host passes the plugin descriptor, sample rate, and bundle
-   path for plugins that need to load additional resources (e.g. waveforms).
-   The features parameter contains host-provided features defined in LV2
-   extensions, but this simple plugin does not use any.
-
-   This function is in the ``instantiation'' threading class, so no other
-   methods on this instance will be called concurrently with it.
-*/
-static LV2_Handle
-instantiate(const LV2_Descriptor*     descriptor,
-            double                    rate,
-            const char*               bundle_path,
-            const LV2_Feature* const* features)
-{
-    PsxReverb* psxrev = (PsxReverb*)calloc(1, sizeof(PsxReverb));
+/* design the windowed sinc lowpass shared by the decimator and interpolator */
+static void resampler_init(PsxResampler *rs, uint32_t factor) {
+    const uint32_t len = factor * RESAMPLER_TAPS;
+    const double fc = 0.45 / factor;
+    double sum = 0.0;
 
-    /* init logging */
-    const char* missing = lv2_features_query(
-        features,
-        LV2_LOG__log,  &psxrev->logger.log, false,
-        LV2_URID__map, &psxrev->map, true,
-        NULL);
-    lv2_log_logger_set_map(&psxrev->logger, psxrev->map);
+    memset(rs, 0, sizeof(*rs));
+    rs->factor = factor;
 
-    if (missing) {
-        lv2_log_error(&psxrev->logger, "Missing feature <%s>\n", missing);
-        free(psxrev);
-        return NULL;
+    for (uint32_t i = 0; i < len; i++) {
+        const double x = i - (len - 1) / 2.0;
+        const double w = 0.42 - 0.5 * cos(2.0 * M_PI * i / (len - 1)) + 0.08 * cos(4.0 * M_PI * i / (len - 1));
+        const double h = (x == 0.0) ? 2.0 * fc : sin(2.0 * M_PI * fc * x) / (M_PI * x);
+        rs->dec_coef[i] = (float)(h * w);
+        sum += h * w;
     }
+    for (uint32_t i = 0; i < len; i++)
+        rs->dec_coef[i] = (float)(rs->dec_coef[i] / sum);
 
-    /* low samplerates are not supported */
-    if (rate <= 1.0) {
-        lv2_log_error(&psxrev->logger, "Samplerate is too low: %f\n", rate);
-        free(psxrev);
-        return NULL;
+    /* split into branches, ordered oldest to newest sample like the history */
+    for (uint32_t p = 0; p < factor; p++) {
+        for (uint32_t i = 0; i < RESAMPLER_TAPS; i++)
+            rs->int_coef[p][i] = rs->dec_coef[p + (RESAMPLER_TAPS - 1 - i) * factor] * factor;
     }
+}
 
-    psxrev->rate = (float)rate;
-
-    /* alloc reverb buffer */
-    psxrev->spu_buffer_count = ceilpower2((uint32_t)ceil(SPU_REV_PRESET_LONGEST_COUNT * (rate / SPU_REV_RATE)));
-    psxrev->spu_buffer_count_mask = psxrev->spu_buffer_count - 1; // <-- we can use this for quick circular buffer access
-    psxrev->spu_buffer = calloc(psxrev->spu_buffer_count, sizeof(float));
-    if (psxrev->spu_buffer == NULL) {
-        lv2_log_error(&psxrev->logger, "Could not allocate SPU buffer\n");
-        free(psxrev);
-        return NULL;
-    }
+static void resampler_reset(PsxResampler *rs) {
+    rs->phase_in = 0;
+    rs->phase_out = 0;
+    rs->pos_in = 0;
+    rs->pos_out = 0;
+    memset(rs->hist_in, 0, sizeof(rs->hist_in));
+    memset(rs->hist_out, 0, sizeof(rs->hist_out));
+}
 
-    return (LV2_Handle)psxrev;
+static float fir(const float *coef, const float *x, uint32_t len) {
+    float acc = 0.0f;
+    for (uint32_t i = 0; i < len; i++)
+        acc += coef[i] * x[i];
+    return acc;
 }
 
-/**
-   The `connect_port()` method is called by the host to connect a particular
-   port to a buffer.  The plugin must store the data location, but data may not
-   be accessed except in run().
+/* push one host rate sample, returns true if a new SPU rate sample is due */
+static bool resampler_push(PsxResampler *rs, float l, float r, float *dl, float *dr) {
+    const uint32_t len = rs->factor * RESAMPLER_TAPS;
+    const uint32_t pos = rs->pos_in;
 
-   This method is in the ``audio'' threading class, and is called in the same
-   context as run().
-*/
-static void
-connect_port(LV2_Handle instance,
-             uint32_t   port,
-             void*      data)
-{
-    PsxReverb* psx_rev = (PsxReverb*)instance;
+    rs->hist_in[0][pos] = rs->hist_in[0][pos + len] = l;
+    rs->hist_in[1][pos] = rs->hist_in[1][pos + len] = r;
+    rs->pos_in = (pos + 1 == len) ? 0 : pos + 1;
 
-    switch ((PortIndex)port) {
-    case PSX_REV_WET:
-        psx_rev->port_wet = (const float*)data;
-        break;
-    case PSX_REV_DRY:
-        psx_rev->port_dry = (const float*)data;
-        break;
-    case PSX_REV_PRESET:
-        psx_rev->port_preset = (const float*)data;
-        break;
-    case PSX_REV_MASTER:
-        psx_rev->port_master = (const float*)data;
-        break;
-    case PSX_REV_MAIN0_IN:
-        psx_rev->port_main0_in = (const float*)data;
-        break;
-    case PSX_REV_MAIN1_IN:
-        psx_rev->port_main1_in = (const float*)data;
-        break;
-    case PSX_REV_MAIN0_OUT:
-        psx_rev->port_main0_out = (float*)data;
-        break;
-    case PSX_REV_MAIN1_OUT:
-        psx_rev->port_main1_out = (float*)data;
-        break;
-    }
+    if (++rs->phase_in < rs->factor)
+        return false;
+
+    rs->phase_in = 0;
+    *dl = fir(rs->dec_coef, &rs->hist_in[0][pos + 1], len);
+    *dr = fir(rs->dec_coef, &rs->hist_in[1][pos + 1], len);
+    return true;
 }
 
-/**
-   The `activate()` method is called by the host to initialise and prepare the
-   plugin instance for running.  The plugin must reset all internal state
-   except for buffer locations set by `connect_port()`.  Since this plugin has
-   no other internal state, this method does nothing.
+static void resampler_put(PsxResampler *rs, float l, float r) {
+    const uint32_t pos = rs->pos_out;
 
-   This method is in the ``instantiation'' threading class, so no other
-   methods on this instance will be called concurrently with it.
-*/
-static void
-activate(LV2_Handle instance)
-{
-    PsxReverb* psx_rev = (PsxReverb*)instance;
-    psx_rev->dry = 1.0f;
-    psx_rev->wet = 1.0f;
-    psx_rev->preset = 0;
-    preset_load(psx_rev, psx_rev->preset);
-    psx_rev->master = 1.0f;
-    psx_rev->BufferAddress = 0;
-    memset(psx_rev->spu_buffer, 0, psx_rev->spu_buffer_count * sizeof(psx_rev->spu_buffer[0]));
+    rs->hist_out[0][pos] = rs->hist_out[0][pos + RESAMPLER_TAPS] = l;
+    rs->hist_out[1][pos] = rs->hist_out[1][pos + RESAMPLER_TAPS] = r;
+    rs->pos_out = (pos + 1 == RESAMPLER_TAPS) ? 0 : pos + 1;
 }
 
-/** Define a macro for converting a gain in dB to a coefficient. */
-#define DB_CO(g) ((g) > -90.0f ? powf(10.0f, (g) * 0.05f) : 0.0f)
+/* advance the interpolator by one host rate sample, returns true if it takes a new SPU rate sample */
+static bool resampler_tick(PsxResampler *rs) {
+    if (++rs->phase_out < rs->factor)
+        return false;
 
-/**
-   The `run()` method is the main process function of the plugin.  It processes
-   a block of audio in the audio context.  Since this plugin is
-   `lv2:hardRTCapable`, `run()` must be real-time safe, so blocking (e.g. with
-   a mutex) or memory allocation are not allowed.
-*/
-static void
-run(LV2_Handle instance, uint32_t n_samples)
-{
-    PsxReverb* rev = (PsxReverb*)instance;
+    rs->phase_out = 0;
+    return true;
+}
 
-    /* load preset if it was changed */
-    int preset = (int)*rev->port_preset;
-    if (preset != rev->preset)
-        preset_load(rev, preset);
+/* interpolated host rate sample for the current phase */
+static void resampler_pull(const PsxResampler *rs, float *l, float *r) {
+    const float *coef = rs->int_coef[rs->phase_out];
+    *l = fir(coef, &rs->hist_out[0][rs->pos_out], RESAMPLER_TAPS);
+    *r = fir(coef, &rs->hist_out[1][rs->pos_out], RESAMPLER_TAPS);
+}
 
-    const float wet_gain = *(rev->port_wet);
-    const float wet_coef = DB_CO(wet_gain);
-    const float dry_gain = *(rev->port_dry);
-    const float dry_coef = DB_CO(dry_gain);
-    const float master_gain = *(rev->port_master);
-    const float master_coef = DB_CO(master_gain);
+static void eco_init(PsxEco *eco, uint32_t factor) {
+    memset(eco, 0, sizeof(*eco));
+    eco->factor = factor;
+    eco->step = 1.0f / factor;
+}
 
-    for (uint32_t i = 0; i < n_samples; i++) {
-        rev->dry += 0.001f * (dry_coef - rev->dry);
-        rev->wet += 0.001f * (wet_coef - rev->wet);
-        rev->master += 0.001f * (master_coef - rev->master);
+static void eco_reset(PsxEco *eco) {
+    eco_init(eco, eco->factor);
+}
 
-#define mem(idx) (rev->spu_buffer[(unsigned)((idx) + rev->BufferAddress) & rev->spu_buffer_count_mask])
-        const float LeftInput  = rev->port_main0_in[i];
-        const float RightInput = rev->port_main1_in[i];
+/* add one host rate sample, returns true if a new network sample is due */
+static bool eco_push(PsxEco *eco, float l, float r, float *dl, float *dr) {
+    eco->sum[0] += l;
+    eco->sum[1] += r;
+    if (++eco->phase_in < eco->factor)
+        return false;
 
-        const float Lin = rev->vLIN * LeftInput;
-        const float Rin = rev->vRIN * RightInput;
+    eco->phase_in = 0;
+    *dl = eco->sum[0] * eco->step;
+    *dr = eco->sum[1] * eco->step;
+    eco->sum[0] = 0.0f;
+    eco->sum[1] = 0.0f;
+    return true;
+}
 
-        // same side reflection
-        mem(rev->mLSAME) = (Lin + mem(rev->dLSAME) * rev->vWALL - mem(rev->mLSAME-1)) * rev->vIIR + mem(rev->mLSAME-1);
-        mem(rev->mRSAME) = (Rin + mem(rev->dRSAME) * rev->vWALL - mem(rev->mRSAME-1)) * rev->vIIR + mem(rev->mRSAME-1);
+/* advance the interpolator by one host rate sample, returns true if it takes a new network sample */
+static bool eco_tick(PsxEco *eco) {
+    if (++eco->phase_out < eco->factor)
+        return false;
 
-        // different side reflection
-        mem(rev->mLDIFF) = (Lin + mem(rev->dRDIFF) * rev->vWALL - mem(rev->mLDIFF-1)) * rev->vIIR + mem(rev->mLDIFF-1);
-        mem(rev->mRDIFF) = (Rin + mem(rev->dLDIFF) * rev->vWALL - mem(rev->mRDIFF-1)) * rev->vIIR + mem(rev->mRDIFF-1);
+    eco->phase_out = 0;
+    return true;
+}
 
-        // early echo
-        float Lout = rev->vCOMB1 * mem(rev->mLCOMB1) + rev->vCOMB2 * mem(rev->mLCOMB2) + rev->vCOMB3 * mem(rev->mLCOMB3) + rev->vCOMB4 * mem(rev->mLCOMB4);
-        float Rout = rev->vCOMB1 * mem(rev->mRCOMB1) + rev->vCOMB2 * mem(rev->mRCOMB2) + rev->vCOMB3 * mem(rev->mRCOMB3) + rev->vCOMB4 * mem(rev->mRCOMB4);
+static void eco_put(PsxEco *eco, float l, float r) {
+    eco->prev[0] = eco->next[0];
+    eco->prev[1] = eco->next[1];
+    eco->next[0] = l;
+    eco->next[1] = r;
+}
 
-        // late reverb APF1
-        Lout -= rev->vAPF1 * mem(rev->mLAPF1-rev->dAPF1); mem(rev->mLAPF1) = Lout; Lout = Lout * rev->vAPF1 + mem(rev->mLAPF1-rev->dAPF1);
-        Rout -= rev->vAPF1 * mem(rev->mRAPF1-rev->dAPF1); mem(rev->mRAPF1) = Rout; Rout = Rout * rev->vAPF1 + mem(rev->mRAPF1-rev->dAPF1);
+/* interpolated host rate sample, it reaches the newest network sample at the end of its period */
+static void eco_pull(const PsxEco *eco, float *l, float *r) {
+    const float t = (eco->phase_out + 1) * eco->step;
+    *l = eco->prev[0] + (eco->next[0] - eco->prev[0]) * t;
+    *r = eco->prev[1] + (eco->next[1] - eco->prev[1]) * t;
+}
 
-        // late reverb APF2
-        Lout -= rev->vAPF2 * mem(rev->mLAPF2-rev->dAPF2); mem(rev->mLAPF2) = Lout; Lout = Lout * rev->vAPF2 + mem(rev->mLAPF2-rev->dAPF2);
-        Rout -= rev->vAPF2 * mem(rev->mRAPF2-rev->dAPF2); mem(rev->mRAPF2) = Rout; Rout = Rout * rev->vAPF2 + mem(rev->mRAPF2-rev->dAPF2);
-#undef mem
+/* table row of the rate a network runs at, the eco engine has a rate of its own */
+static unsigned
+network_row(bool native, PsxReverbEngine engine)
+{
+    if (engine == PSX_REV_ENGINE_ECO)
+        return PSX_REV_RATE_ECO;
+    return native ? PSX_REV_RATE_SPU : PSX_REV_RATE_HOST;
+}
 
-        // output to mixer
-        const float LeftOutput  = Lout;
-        const float RightOutput = Rout;
+/* host samples per network sample */
+static uint32_t
+network_factor(const PsxReverb *rev, unsigned row)
+{
+    if (row == PSX_REV_RATE_ECO)
+        return rev->net[0].eco.factor;
+    return row == PSX_REV_RATE_SPU ? rev->net[0].resampler.factor : 1;
+}
+
+/* rate the reverb network runs at */
+static float
+network_rate(const PsxReverb *rev, unsigned row)
+{
+    return rev->rate / network_factor(rev, row);
+}
 
-        rev->BufferAddress = ((rev->BufferAddress + 1) & rev->spu_buffer_count_mask);
+/* longest time in host samples anything written to the network's memory stays there */
+static uint32_t
+network_tail(const PsxReverb *rev)
+{
+    size_t len = rev->params->buffer_count;
 
-        rev->port_main0_out[i] = (LeftOutput  * rev->wet + Lin * rev->dry) * rev->master;
-        rev->port_main1_out[i] = (RightOutput * rev->wet + Rin * rev->dry) * rev->master;
+    if (rev->kernel == PSX_REV_ENGINE_LINES) {
+        for (uint32_t i = 0; i < NUM_LINES; i++) {
+            if (len < rev->params->lines.mask[i] + 1u)
+                len = rev->params->lines.mask[i] + 1u;
+        }
     }
+    len *= network_factor(rev, network_row(rev->native, rev->kernel));
+    return (uint32_t)len;
 }
 
-/**
-   The `deactivate()` method is the counterpart to `activate()`, and is called by
-   the host after running the plugin.  It indicates that the host will not call
-   `run()` again until another call to `activate()` and is mainly useful for more
-   advanced plugins with ``live'' characteristics such as those with auxiliary
-   processing threads.  As with `activate()`, this plugin has no use for this
-   information so this method does nothing.
-
-   This method is in the ``instantiation'' threading class, so no other
-   methods on this instance will be called concurrently with it.
-*/
+/* point the networks at their part of spu_buffer and reset them */
 static void
-deactivate(LV2_Handle instance)
+networks_reset(PsxReverb *rev)
 {
+    pool_sync(rev);
+    rev->tail = network_tail(rev);
+    for (uint32_t k = 0; k < rev->variant->pairs; k++) {
+        PsxReverbNetwork *net = &rev->net[k];
+        net->buffer = rev->spu_buffer + k * rev->spu_buffer_count;
+        net->BufferAddress = 0;
+        net->lines_time = 0;
+        /* the buffer is clear, so there is no tail to wait for */
+        net->quiet = rev->tail;
+        resampler_reset(&net->resampler);
+        eco_reset(&net->eco);
+    }
 }
 
 /**
-   Destroy a plugin instance (counterpart to `instantiate()`).
-
-   This method is in the ``instantiation'' threading class, so no other
-   methods on this instance will be called concurrently with it.
+   Allocate the second set of networks crossfades run the old preset on.  It
+   is a `PsxReverb` so the networks run on it like on the instance itself, but
+   only the fields of the networks and their buffer are used.  The buffer fits
+   every preset built in, so it doesn't have to be resized for a crossfade.
 */
 static void
-cleanup(LV2_Handle instance)
+fade_setup(PsxReverb *rev, PsxReverb *fade, float *buffer, size_t shared_count, size_t count)
 {
-    PsxReverb* rev = (PsxReverb*)instance;
+    fade->spu_buffer = buffer;
+    fade->variant = rev->variant;
+    fade->rate = rev->rate;
+    fade->spu_buffer_resize = rev->spu_buffer_resize;
+    fade->spu_buffer_count = count;
+    fade->spu_buffer_count_mask = shared_count - 1;
+    for (uint32_t k = 0; k < rev->variant->pairs; k++) {
+        resampler_init(&fade->net[k].resampler, rev->net[0].resampler.factor);
+        eco_init(&fade->net[k].eco, rev->net[0].eco.factor);
+    }
 
-    free(rev->spu_buffer);
-    free(rev);
+    rev->fade = fade;
+    rev->fade_count = count;
+    rev->fade_state = PSX_REV_FADE_IDLE;
 }
 
-/**
-   The `extension_data()` function returns any extension data supported by the
-   plugin.  Note that this is not an instance method, but a function on the
-   plugin descriptor.  It is usually used by plugins to implement additional
-   interfaces.  This plugin does not have any extension data, so this function
-   returns NULL.
-
-   This method is in the ``discovery'' threading class, so no other functions
-   or methods in this plugin library will be called concurrently with it.
-*/
-static const void*
-extension_data(const char* uri)
+static bool
+fade_open(PsxReverb *rev, size_t shared_count, size_t count)
 {
-    return NULL;
+    PsxReverb *fade = (PsxReverb*)calloc(1, sizeof(PsxReverb));
+    if (fade == NULL)
+        return false;
+
+    float *buffer = calloc(count * rev->variant->pairs, sizeof(float));
+    if (buffer == NULL) {
+        free(fade);
+        return false;
+    }
+    fade_setup(rev, fade, buffer, shared_count, count);
+    return true;
 }
 
-/**
-   Every plugin must define an `LV2_Descriptor`.  It is best to define
-   descriptors statically to avoid leaking memory and non-portable shared
-   library constructors and destructors to clean up properly.
-*/
-static const LV2_Descriptor descriptor = {
-    PSX_REV_URI,
-    instantiate,
-    connect_port,
-    activate,
-    run,
-    deactivate,
-    cleanup,
-    extension_data
-};
+#define PSX_REV_TABLE_SIZE (NUM_RATES * NUM_PRESETS * sizeof(PsxReverbParams))
 
-/**
+/* convert all presets for all network rates */
+static void
+table_fill(const PsxReverb *rev, PsxReverbParams (*table)[NUM_PRESETS])
+{
+    for (unsigned row = 0; row < NUM_RATES; row++) {
+        for (int i = 0; i < NUM_PRESETS; i++) {
+            preset_convert(&table[row][i], i, network_rate(rev, row));
+            if (row == PSX_REV_RATE_ECO)
+                eco_reduce(&table[row][i]);
+        }
+    }
+}
+
+/* alloc a cache line aligned table and fill it */
+static PsxReverbParams (*table_create(const PsxReverb *rev, void **mem))[NUM_PRESETS]
+{
+    *mem = malloc(PSX_REV_TABLE_SIZE + PSX_REV_CACHE_LINE - 1);
+    if (*mem == NULL)
+        return NULL;
+
+    PsxReverbParams (*table)[NUM_PRESETS] = (PsxReverbParams (*)[NUM_PRESETS])PSX_REV_ALIGN((uintptr_t)*mem);
+    table_fill(rev, table);
+    return table;
+}
+
+/**
+   The converted preset tables only depend on the samplerate, so instances at
+   the same rate share them through a small process wide cache.  A slot is
+   claimed by moving it from `TABLE_EMPTY` to `TABLE_BUSY`, filled and
+   published as `TABLE_READY` with one reference.  References are only taken
+   while the count is above zero; whoever drops it to zero frees the table
+   and empties the slot again.  Since a slot can be reused in between, the
+   key is checked again after taking a reference.  If the cache is full,
+   instances keep a table of their own.
+*/
+#define PSX_REV_TABLE_CACHE_SIZE 8
+
+enum { TABLE_EMPTY, TABLE_BUSY, TABLE_READY };
+
+typedef struct PsxTableSlot {
+    uint32_t state;
+    uint32_t refs;
+    uint32_t key;           // bits of the samplerate
+    const PsxReverbParams (*table)[NUM_PRESETS];
+    void    *mem;
+} PsxTableSlot;
+
+#ifdef PSX_REV_ATOMICS
+static PsxTableSlot table_cache[PSX_REV_TABLE_CACHE_SIZE];
+
+static void
+table_cache_release(PsxTableSlot *slot)
+{
+    if (__atomic_sub_fetch(&slot->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    uint32_t ready = TABLE_READY;
+    if (__atomic_compare_exchange_n(&slot->state, &ready, TABLE_BUSY, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        free(slot->mem);
+        slot->mem = NULL;
+        slot->table = NULL;
+        __atomic_store_n(&slot->state, TABLE_EMPTY, __ATOMIC_RELEASE);
+    }
+}
+
+static PsxTableSlot *
+table_cache_acquire(uint32_t key)
+{
+    for (uint32_t i = 0; i < PSX_REV_TABLE_CACHE_SIZE; i++) {
+        PsxTableSlot *slot = &table_cache[i];
+
+        if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != TABLE_READY ||
+            __atomic_load_n(&slot->key, __ATOMIC_RELAXED) != key)
+            continue;
+
+        uint32_t refs = __atomic_load_n(&slot->refs, __ATOMIC_RELAXED);
+        while (refs > 0 && !__atomic_compare_exchange_n(&slot->refs, &refs, refs + 1, true,
+                                                         __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            ;
+        if (refs == 0)
+            continue;
+
+        /* the slot may have been freed and refilled before the reference was taken */
+        if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) == TABLE_READY &&
+            __atomic_load_n(&slot->key, __ATOMIC_RELAXED) == key)
+            return slot;
+        table_cache_release(slot);
+    }
+    return NULL;
+}
+
+static PsxTableSlot *
+table_cache_insert(uint32_t key, const PsxReverbParams (*table)[NUM_PRESETS], void *mem)
+{
+    for (uint32_t i = 0; i < PSX_REV_TABLE_CACHE_SIZE; i++) {
+        PsxTableSlot *slot = &table_cache[i];
+        uint32_t empty = TABLE_EMPTY;
+
+        if (!__atomic_compare_exchange_n(&slot->state, &empty, TABLE_BUSY, false,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;
+        slot->table = table;
+        slot->mem = mem;
+        __atomic_store_n(&slot->key, key, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->refs, 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&slot->state, TABLE_READY, __ATOMIC_RELEASE);
+        return slot;
+    }
+    return NULL;
+}
+#endif
+
+/* get the preset table for the instance's rate, shared if possible */
+static bool
+table_open(PsxReverb *rev)
+{
+    void *mem;
+    PsxReverbParams (*table)[NUM_PRESETS];
+
+#ifdef PSX_REV_ATOMICS
+    uint32_t key;
+    memcpy(&key, &rev->rate, sizeof(key));
+
+    rev->param_table_slot = table_cache_acquire(key);
+    if (rev->param_table_slot) {
+        rev->param_table = rev->param_table_slot->table;
+        rev->param_table_mem = NULL;
+        return true;
+    }
+#endif
+
+    table = table_create(rev, &mem);
+    if (table == NULL)
+        return false;
+    rev->param_table = (const PsxReverbParams (*)[NUM_PRESETS])table;
+    rev->param_table_mem = mem;
+    rev->param_table_slot = NULL;
+
+#ifdef PSX_REV_ATOMICS
+    /* another instance may have inserted the same rate meanwhile, that only costs a slot */
+    rev->param_table_slot = table_cache_insert(key, rev->param_table, mem);
+    if (rev->param_table_slot)
+        rev->param_table_mem = NULL;
+#endif
+    return true;
+}
+
+static void
+table_close(PsxReverb *rev)
+{
+#ifdef PSX_REV_ATOMICS
+    if (rev->param_table_slot)
+        table_cache_release(rev->param_table_slot);
+#endif
+    free(rev->param_table_mem);
+}
+
+/* decimation factors at a host rate: SPU rate mode runs at the closest integer fraction above 22050 Hz */
+static void
+network_factors(double rate, uint32_t *spu, uint32_t *eco)
+{
+    *spu = (uint32_t)(rate / SPU_REV_RATE);
+    if (*spu < 1)
+        *spu = 1;
+    if (*spu > RESAMPLER_FACTOR_MAX)
+        *spu = RESAMPLER_FACTOR_MAX;
+    *eco = (uint32_t)(rate / PSX_REV_ECO_RATE + 0.5);
+    if (*eco < 1)
+        *eco = 1;
+}
+
+/* the one-pole decay of the gain smoothing and the dB table of gain_coefficient() */
+static void
+gain_tables(float decay[PSX_REV_CHUNK + 1], float db[PSX_REV_DB_TABLE])
+{
+    for (uint32_t n = 0; n <= PSX_REV_CHUNK; n++)
+        decay[n] = powf(1.0f - PSX_REV_GAIN_SMOOTHING, (float)n);
+    for (int i = 0; i < PSX_REV_DB_TABLE; i++)
+        db[i] = powf(10.0f, (PSX_REV_DB_MIN + (float)i / PSX_REV_DB_STEPS) * 0.05f);
+}
+
+/* set up what only depends on the variant and rate, shared by instantiate() and psx_reverb_init() */
+static void
+reverb_setup(PsxReverb *rev, const PsxReverbVariant *variant, double rate)
+{
+    uint32_t factor, eco;
+
+    rev->variant = variant;
+    rev->rate = (float)rate;
+
+    gain_tables(rev->gain_decay, rev->gain_db);
+
+    network_factors(rate, &factor, &eco);
+    for (uint32_t k = 0; k < variant->pairs; k++) {
+        resampler_init(&rev->net[k].resampler, factor);
+        eco_init(&rev->net[k].eco, eco);
+    }
+}
+
+/* SPU buffer size per network at `rate`, a power of two fitting the longest preset */
+static size_t
+buffer_shared_count(double rate)
+{
+    return ceilpower2((uint32_t)ceil(SPU_REV_PRESET_LONGEST_COUNT * (rate / SPU_REV_RATE)));
+}
+
+/* buffer size per network fitting every preset on any engine at `rate`, the split one may need more */
+static size_t
+buffer_longest_count(double rate)
+{
+    size_t longest_count = buffer_shared_count(rate);
+    uint32_t factor, eco;
+
+    network_factors(rate, &factor, &eco);
+    for (unsigned row = 0; row < NUM_RATES; row++) {
+        const uint32_t div = row == PSX_REV_RATE_ECO ? eco : row == PSX_REV_RATE_SPU ? factor : 1;
+        for (int i = 0; i < NUM_PRESETS; i++) {
+            PsxReverbParams params;
+
+            preset_convert(&params, i, (float)rate / div);
+            if (row == PSX_REV_RATE_ECO)
+                eco_reduce(&params);
+            if (longest_count < params.lines.count)
+                longest_count = params.lines.count;
+        }
+    }
+    return longest_count;
+}
+
+/**
+   An instance in a single block of memory, for the C interface of
+   psx-reverb.h and the arena of `PSX_REV_ARENA`.  The block holds the
+   instance, the crossfade networks, the preset table and both buffers, each
+   cache line aligned.  The buffers fit the longest preset, so they are never
+   resized, and the table is converted into the block instead of being shared.
+*/
+typedef struct {
+    size_t fade;            // offsets from the aligned start of the block
+    size_t table;
+    size_t buffer;
+    size_t fade_buffer;
+    size_t end;
+    size_t longest_count;
+} PsxReverbBlock;
+
+static bool
+reverb_block(PsxReverbLayout layout, double rate, PsxReverbBlock *block)
+{
+    if ((unsigned)layout >= NUM_VARIANTS || !(rate > 1.0))
+        return false;
+
+    block->longest_count = buffer_longest_count(rate);
+
+    const size_t buffer_size = block->longest_count * variants[layout].pairs * sizeof(float);
+    block->fade = PSX_REV_ALIGN(sizeof(PsxReverb));
+    block->table = block->fade + PSX_REV_ALIGN(sizeof(PsxReverb));
+    block->buffer = block->table + PSX_REV_ALIGN(PSX_REV_TABLE_SIZE);
+    block->fade_buffer = block->buffer + PSX_REV_ALIGN(buffer_size);
+    block->end = block->fade_buffer + PSX_REV_ALIGN(buffer_size);
+    return true;
+}
+
+/* lay out an instance at `rate` in a cleared block of `reverb_block()`, which may be sized for a higher one */
+static PsxReverb *
+reverb_block_init(uint8_t *base, const PsxReverbBlock *block, const PsxReverbVariant *variant, double rate)
+{
+    PsxReverb *rev = (PsxReverb *)base;
+    PsxReverbParams (*table)[NUM_PRESETS] = (PsxReverbParams (*)[NUM_PRESETS])(base + block->table);
+
+    reverb_setup(rev, variant, rate);
+    table_fill(rev, table);
+    rev->param_table = (const PsxReverbParams (*)[NUM_PRESETS])table;
+    rev->spu_buffer = (float *)(base + block->buffer);
+    rev->spu_buffer_count = block->longest_count;
+    rev->spu_buffer_count_mask = buffer_shared_count(rate) - 1;
+    fade_setup(rev, (PsxReverb *)(base + block->fade), (float *)(base + block->fade_buffer),
+               rev->spu_buffer_count_mask + 1, block->longest_count);
+    return rev;
+}
+
+#ifdef PSX_REV_ARENA
+#define PSX_REV_HUGEPAGE (2u << 20)
+
+/**
+   Map a block for the instance and lock it, so `run()` never faults a page
+   in.  Huge pages are tried first, they need pages reserved by the admin
+   (`vm.nr_hugepages`).  Otherwise the kernel is asked for transparent huge
+   pages, so the taps of a large buffer hit fewer TLB entries.  If the memory
+   can't be locked (see `ulimit -l`), it is at least faulted in here.
+*/
+static uint8_t *
+arena_open(size_t size, size_t *mapped, LV2_Log_Logger *logger)
+{
+    const size_t len = (size + PSX_REV_HUGEPAGE - 1) & ~(size_t)(PSX_REV_HUGEPAGE - 1);
+    void *mem = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (mem == MAP_FAILED) {
+        mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            return NULL;
+#ifdef MADV_HUGEPAGE
+        madvise(mem, len, MADV_HUGEPAGE);
+#endif
+    }
+
+    if (mlock(mem, len) != 0) {
+        lv2_log_note(logger, "Could not lock %zu KiB of memory, it may be paged out\n", len >> 10);
+        memset(mem, 0, len);
+    }
+    *mapped = len;
+    return (uint8_t *)mem;
+}
+#endif
+
+/**
+   Allocate the instance with its preset table and buffers.  Built with
+   `PSX_REV_ARENA`, it is one block of `reverb_block()` in an arena if that
+   can be mapped.  Otherwise the table is shared between instances, and the
+   buffer is sized per preset by the worker if the host has one.  Buffers
+   that have to fit every preset are sized for `max_rate` if it is higher,
+   so switching up to it later doesn't allocate them again.
+*/
+static PsxReverb *
+instance_open(uint32_t index, double rate, double max_rate, bool worker, LV2_Log_Logger *logger)
+{
+    const double size_rate = max_rate > rate ? max_rate : rate;
+
+#ifdef PSX_REV_ARENA
+    PsxReverbBlock block;
+    size_t mapped = 0;
+    uint8_t *base = reverb_block(index, size_rate, &block) ? arena_open(block.end, &mapped, logger) : NULL;
+    if (base) {
+        PsxReverb *rev = reverb_block_init(base, &block, &variants[index], rate);
+        rev->arena_size = mapped;
+        return rev;
+    }
+    lv2_log_note(logger, "Could not map the instance, allocating it on the heap\n");
+#endif
+
+    PsxReverb* psxrev = (PsxReverb*)calloc(1, sizeof(PsxReverb));
+    if (psxrev == NULL)
+        return NULL;
+
+    reverb_setup(psxrev, &variants[index], rate);
+
+    /* convert all presets up front, switching presets is only a lookup then */
+    if (!table_open(psxrev)) {
+        lv2_log_error(logger, "Could not allocate preset table\n");
+        free(psxrev);
+        return NULL;
+    }
+
+    const size_t shared_count = buffer_shared_count(rate);
+    const size_t longest_count = buffer_longest_count(size_rate);
+
+    /* alloc reverb buffer, without worker it has to fit the longest preset */
+    psxrev->spu_buffer_resize = worker;
+    if (psxrev->spu_buffer_resize)
+        psxrev->spu_buffer_count = psxrev->param_table[0][0].buffer_count;
+    else
+        psxrev->spu_buffer_count = shared_count;
+    psxrev->spu_buffer_count_mask = psxrev->spu_buffer_count - 1; // <-- we can use this for quick circular buffer access
+    if (!psxrev->spu_buffer_resize)
+        psxrev->spu_buffer_count = longest_count;
+    psxrev->spu_buffer = calloc(psxrev->spu_buffer_count * psxrev->variant->pairs, sizeof(float));
+    if (psxrev->spu_buffer == NULL || !fade_open(psxrev, shared_count, longest_count)) {
+        lv2_log_error(logger, "Could not allocate SPU buffer\n");
+        free(psxrev->spu_buffer);
+        table_close(psxrev);
+        free(psxrev);
+        return NULL;
+    }
+    return psxrev;
+}
+
+static void
+instance_close(PsxReverb *rev)
+{
+#ifdef PSX_REV_ARENA
+    if (rev->arena_size) {
+        munmap(rev, rev->arena_size);
+        return;
+    }
+#endif
+    table_close(rev);
+    free(rev->fade->spu_buffer);
+    free(rev->fade);
+    free(rev->spu_buffer);
+    free(rev);
+}
+
+/* the value of a samplerate option, hosts send them as any kind of number */
+static bool
+option_rate(const LV2_Options_Option *opt, LV2_URID_Map *map, double *rate)
+{
+    if (opt->type == map->map(map->handle, LV2_ATOM__Float) && opt->size == sizeof(float))
+        *rate = *(const float *)opt->value;
+    else if (opt->type == map->map(map->handle, LV2_ATOM__Double) && opt->size == sizeof(double))
+        *rate = *(const double *)opt->value;
+    else if (opt->type == map->map(map->handle, LV2_ATOM__Int) && opt->size == sizeof(int32_t))
+        *rate = *(const int32_t *)opt->value;
+    else
+        return false;
+    return *rate > 1.0;
+}
+
+/**
+   The highest samplerate the host announces it may switch the instance to
+   with the options interface, as `#maxSampleRate` in the options feature.  0
+   if it doesn't.
+*/
+static double
+options_max_rate(const LV2_Options_Option *options, LV2_URID_Map *map)
+{
+    const LV2_URID key = map->map(map->handle, PSX_REV_URI "#maxSampleRate");
+    double rate;
+
+    for (const LV2_Options_Option *opt = options; opt && opt->key; opt++) {
+        if (opt->context == LV2_OPTIONS_INSTANCE && opt->key == key && option_rate(opt, map, &rate))
+            return rate;
+    }
+    return 0.0;
+}
+
+/**
+   The `instantiate()` function is called by the host to create a new plugin
+   instance.  The host passes the plugin descriptor, sample rate, and bundle
+   path for plugins that need to load additional resources (e.g. waveforms).
+   The features parameter contains host-provided features defined in LV2
+   extensions, but this simple plugin does not use any.
+
+   This function is in the ``instantiation'' threading class, so no other
+   methods on this instance will be called concurrently with it.
+*/
+static LV2_Handle
+instantiate(const LV2_Descriptor*     descriptor,
+            double                    rate,
+            const char*               bundle_path,
+            const LV2_Feature* const* features)
+{
+    uint32_t index = 0;
+    for (uint32_t i = 0; i < NUM_VARIANTS; i++) {
+        if (!strcmp(descriptor->URI, variants[i].uri))
+            index = i;
+    }
+    assert(!strcmp(descriptor->URI, variants[index].uri));
+
+    /* init logging, into locals since the instance isn't allocated yet */
+    LV2_Log_Logger logger;
+    LV2_URID_Map *map = NULL;
+    LV2_Worker_Schedule *schedule = NULL;
+    const LV2_Options_Option *options = NULL;
+    memset(&logger, 0, sizeof(logger));
+    const char* missing = lv2_features_query(
+        features,
+        LV2_LOG__log,  &logger.log, false,
+        LV2_URID__map, &map, true,
+        LV2_WORKER__schedule, &schedule, false,
+        LV2_OPTIONS__options, &options, false,
+        NULL);
+    lv2_log_logger_set_map(&logger, map);
+
+    if (missing) {
+        lv2_log_error(&logger, "Missing feature <%s>\n", missing);
+        return NULL;
+    }
+
+    /* low samplerates are not supported */
+    if (rate <= 1.0) {
+        lv2_log_error(&logger, "Samplerate is too low: %f\n", rate);
+        return NULL;
+    }
+
+    PsxReverb* psxrev = instance_open(index, rate, options_max_rate(options, map), schedule != NULL, &logger);
+    if (psxrev == NULL)
+        return NULL;
+    psxrev->logger = logger;
+    psxrev->map = map;
+    psxrev->schedule = schedule;
+
+    psxrev->uris.atom_Bool  = map->map(map->handle, LV2_ATOM__Bool);
+    psxrev->uris.atom_Float = map->map(map->handle, LV2_ATOM__Float);
+    psxrev->uris.atom_Int   = map->map(map->handle, LV2_ATOM__Int);
+    psxrev->uris.atom_Chunk = map->map(map->handle, LV2_ATOM__Chunk);
+    psxrev->uris.atom_Path  = map->map(map->handle, LV2_ATOM__Path);
+    psxrev->uris.atom_URID  = map->map(map->handle, LV2_ATOM__URID);
+    psxrev->uris.atom_Vector = map->map(map->handle, LV2_ATOM__Vector);
+    psxrev->uris.atom_Object = map->map(map->handle, LV2_ATOM__Object);
+    psxrev->uris.atom_Blank = map->map(map->handle, LV2_ATOM__Blank);
+    psxrev->uris.patch_Set  = map->map(map->handle, LV2_PATCH__Set);
+    psxrev->uris.patch_property = map->map(map->handle, LV2_PATCH__property);
+    psxrev->uris.patch_value = map->map(map->handle, LV2_PATCH__value);
+    psxrev->uris.param_sampleRate = map->map(map->handle, LV2_PARAMETERS__sampleRate);
+    psxrev->uris.registers  = map->map(map->handle, PSX_REV_URI "#registers");
+    psxrev->uris.registerFile = map->map(map->handle, PSX_REV_URI "#registerFile");
+    psxrev->uris.preset     = map->map(map->handle, PSX_REV_URI "#preset");
+    psxrev->uris.native     = map->map(map->handle, PSX_REV_URI "#native");
+    psxrev->uris.engine     = map->map(map->handle, PSX_REV_URI "#engine");
+    psxrev->uris.wet        = map->map(map->handle, PSX_REV_URI "#wet");
+    psxrev->uris.dry        = map->map(map->handle, PSX_REV_URI "#dry");
+    psxrev->uris.master     = map->map(map->handle, PSX_REV_URI "#master");
+    psxrev->uris.tail       = map->map(map->handle, PSX_REV_URI "#tail");
+    psxrev->uris.Tail       = map->map(map->handle, PSX_REV_URI "#Tail");
+
+    return (LV2_Handle)psxrev;
+}
+
+/**
+   The `connect_port()` method is called by the host to connect a particular
+   port to a buffer.  The plugin must store the data location, but data may not
+   be accessed except in run().
+
+   This method is in the ``audio'' threading class, and is called in the same
+   context as run().
+*/
+static void
+connect_port(LV2_Handle instance,
+             uint32_t   port,
+             void*      data)
+{
+    PsxReverb* psx_rev = (PsxReverb*)instance;
+    const uint32_t inputs = psx_rev->variant->inputs;
+    const uint32_t outputs = 2 * psx_rev->variant->pairs;
+
+    /* audio ports follow the gains, the other controls follow the audio ports */
+    if (port >= PSX_REV_MAIN0_IN && port < PSX_REV_MAIN0_IN + inputs) {
+        psx_rev->in[port - PSX_REV_MAIN0_IN] = (const float*)data;
+        return;
+    }
+    if (port >= PSX_REV_MAIN0_IN + inputs && port < PSX_REV_MAIN0_IN + inputs + outputs) {
+        psx_rev->out[port - PSX_REV_MAIN0_IN - inputs] = (float*)data;
+        return;
+    }
+    if (port >= PSX_REV_MAIN0_IN + inputs + outputs) {
+        port = port - inputs - outputs + PSX_REV_NATIVE - PSX_REV_MAIN0_IN;
+        if (!psx_rev->variant->threads && port >= PSX_REV_THREADS_PORT)
+            port++;
+    }
+
+    switch ((PortIndex)port) {
+    case PSX_REV_WET:
+        psx_rev->port_wet = (const float*)data;
+        break;
+    case PSX_REV_DRY:
+        psx_rev->port_dry = (const float*)data;
+        break;
+    case PSX_REV_PRESET:
+        psx_rev->port_preset = (const float*)data;
+        break;
+    case PSX_REV_MASTER:
+        psx_rev->port_master = (const float*)data;
+        break;
+    case PSX_REV_NATIVE:
+        psx_rev->port_native = (const float*)data;
+        break;
+    case PSX_REV_ENGINE:
+        psx_rev->port_engine = (const float*)data;
+        break;
+    case PSX_REV_CONTROL:
+        psx_rev->port_control = (const LV2_Atom_Sequence*)data;
+        break;
+    case PSX_REV_CROSSFADE:
+        psx_rev->port_crossfade = (const float*)data;
+        break;
+    case PSX_REV_THREADS_PORT:
+        psx_rev->port_threads = (const float*)data;
+        break;
+    case PSX_REV_LOAD:
+        psx_rev->port_load = (float*)data;
+        break;
+    case PSX_REV_LOAD_PEAK:
+        psx_rev->port_load_peak = (float*)data;
+        break;
+    case PSX_REV_RELOADS:
+        psx_rev->port_reloads = (float*)data;
+        break;
+    case PSX_REV_RELOAD_TIME:
+        psx_rev->port_reload_time = (float*)data;
+        break;
+    case PSX_REV_IDLE:
+        psx_rev->port_idle = (float*)data;
+        break;
+    case PSX_REV_DENORMALS:
+        psx_rev->port_denormals = (float*)data;
+        break;
+    case PSX_REV_FREEWHEEL:
+        psx_rev->port_freewheel = (const float*)data;
+        break;
+    default:
+        break;
+    }
+}
+
+/* monotonic time for the stats, it is read from the vDSO on Linux so run() can use it */
+static uint64_t
+stats_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+/* start a new window, the preset loads count from activate() on */
+static void
+stats_reset(PsxReverb *rev)
+{
+    memset(&rev->stats.last, 0, sizeof(rev->stats.last));
+    rev->stats.window_ns = 0;
+    rev->stats.window_samples = 0;
+    rev->stats.window_peak = 0.0f;
+    rev->stats.reload_ns = 0;
+}
+
+/* start at 0 dB like the port defaults */
+static void
+gain_reset(PsxGain *g)
+{
+    g->db = 0.0f;
+    g->port = NAN;
+    g->target = 1.0f;
+    g->value = 1.0f;
+}
+
+/* back to the port defaults with a clear buffer, for activate() and psx_reverb_reset() */
+static void
+reverb_reset(PsxReverb *rev)
+{
+    pool_sync(rev);
+    gain_reset(&rev->dry);
+    gain_reset(&rev->wet);
+    rev->preset_request = 0;
+    rev->preset_port = NAN;
+    rev->native = false;
+    rev->engine = PSX_REV_ENGINE_SHARED;
+    rev->engine_request = PSX_REV_ENGINE_SHARED;
+    rev->native_request = false;
+    rev->freewheel = false;
+    rev->threads = false;
+    rev->crossfade = 0.0f;
+    rev->switching = false;
+    rev->pending = NULL;
+    rev->custom_selected = false;
+    rev->custom_queued = false;
+    fade_reset(rev);
+    stats_reset(rev);
+    preset_load(rev, 0);
+    networks_reset(rev);
+    gain_reset(&rev->master);
+}
+
+/**
+   The `activate()` method is called by the host to initialise and prepare the
+   plugin instance for running.  The plugin must reset all internal state
+   except for buffer locations set by `connect_port()`.  Since this plugin has
+   no other internal state, this method does nothing.
+
+   This method is in the ``instantiation'' threading class, so no other
+   methods on this instance will be called concurrently with it.
+*/
+static void
+activate(LV2_Handle instance)
+{
+    PsxReverb* psx_rev = (PsxReverb*)instance;
+
+    /* a state restored before activation is kept, see state_restore() */
+    if (psx_rev->restored) {
+        psx_rev->restored = false;
+        return;
+    }
+    reverb_reset(psx_rev);
+}
+
+/**
+   Convert a gain in dB to a coefficient.  Within the range of the ports this
+   interpolates the table from reverb_setup(), which is exact on each step, so
+   automation doesn't cost a powf() per block.  Only events or API calls
+   beyond that range compute the coefficient.
+*/
+static float
+gain_coefficient(const float *table, float db)
+{
+    if (db >= PSX_REV_DB_MIN && db <= PSX_REV_DB_MAX) {
+        const float x = (db - PSX_REV_DB_MIN) * PSX_REV_DB_STEPS;
+        int i = (int)x;
+        if (i > PSX_REV_DB_TABLE - 2)
+            i = PSX_REV_DB_TABLE - 2;
+        return table[i] + (table[i + 1] - table[i]) * (x - (float)i);
+    }
+    return db > -90.0f ? powf(10.0f, db * 0.05f) : 0.0f;
+}
+
+static void
+gain_set(PsxGain *g, const float *table, float db)
+{
+    if (db != g->db) {
+        g->db = db;
+        g->target = gain_coefficient(table, db);
+    }
+}
+
+/* follow the port only when it changes, so a value set by an event stays until then */
+static void
+gain_port(PsxGain *g, const float *table, float db)
+{
+    if (db != g->port) {
+        g->port = db;
+        gain_set(g, table, db);
+    }
+}
+
+/**
+   Get the gain for the next `n` samples as `start + (i + 1) * step`.  While
+   moving, the ramp ends where the per sample one-pole would be after `n`
+   samples.  Returns false once the gain has settled and is constant.
+*/
+static bool
+gain_ramp(PsxGain *g, const float *decay, uint32_t n, float *start, float *step)
+{
+    *start = g->value;
+
+    if (fabsf(g->target - g->value) <= PSX_REV_GAIN_EPSILON) {
+        g->value = g->target;
+        *start = g->value;
+        *step = 0.0f;
+        return false;
+    }
+
+    const float end = g->target + (g->value - g->target) * decay[n];
+    *step = (end - g->value) / (float)n;
+    g->value = end;
+    return true;
+}
+
+/* run one sample through the SPU reverb network, leaving out the stages `topo` says aren't needed */
+static PSX_REV_INLINE void
+spu_reverb_step(PsxReverb *rev, PsxReverbNetwork *net, float Lin, float Rin, float *LeftOutput, float *RightOutput,
+                const unsigned topo)
+{
+    const PsxReverbParams *p = rev->params;
+
+#define mem(idx) (net->buffer[(unsigned)((idx) + net->BufferAddress) & rev->spu_buffer_count_mask])
+    // same side reflection
+    mem(p->mLSAME) = (Lin + mem(p->dLSAME) * p->vWALL - mem(p->mLSAME-1)) * p->vIIR + mem(p->mLSAME-1);
+    mem(p->mRSAME) = (Rin + mem(p->dRSAME) * p->vWALL - mem(p->mRSAME-1)) * p->vIIR + mem(p->mRSAME-1);
+
+    // different side reflection
+    if (!(topo & PSX_REV_TOPO_DIFF)) {
+        mem(p->mLDIFF) = (Lin + mem(p->dRDIFF) * p->vWALL - mem(p->mLDIFF-1)) * p->vIIR + mem(p->mLDIFF-1);
+        mem(p->mRDIFF) = (Rin + mem(p->dLDIFF) * p->vWALL - mem(p->mRDIFF-1)) * p->vIIR + mem(p->mRDIFF-1);
+    }
+
+    // early echo
+    float Lout = p->vCOMB1 * mem(p->mLCOMB1);
+    float Rout = p->vCOMB1 * mem(p->mRCOMB1);
+    if (!(topo & PSX_REV_TOPO_COMB2)) {
+        Lout += p->vCOMB2 * mem(p->mLCOMB2);
+        Rout += p->vCOMB2 * mem(p->mRCOMB2);
+    }
+    if (!(topo & PSX_REV_TOPO_COMB34)) {
+        Lout = Lout + p->vCOMB3 * mem(p->mLCOMB3) + p->vCOMB4 * mem(p->mLCOMB4);
+        Rout = Rout + p->vCOMB3 * mem(p->mRCOMB3) + p->vCOMB4 * mem(p->mRCOMB4);
+    }
+
+    if (topo & PSX_REV_TOPO_APF) {
+        // late reverb APF1 and APF2 without gain only delay
+        mem(p->mLAPF1) = Lout; Lout = mem(p->mLAPF1-p->dAPF1);
+        mem(p->mRAPF1) = Rout; Rout = mem(p->mRAPF1-p->dAPF1);
+        mem(p->mLAPF2) = Lout; Lout = mem(p->mLAPF2-p->dAPF2);
+        mem(p->mRAPF2) = Rout; Rout = mem(p->mRAPF2-p->dAPF2);
+    } else {
+        // late reverb APF1
+        Lout -= p->vAPF1 * mem(p->mLAPF1-p->dAPF1); mem(p->mLAPF1) = Lout; Lout = Lout * p->vAPF1 + mem(p->mLAPF1-p->dAPF1);
+        Rout -= p->vAPF1 * mem(p->mRAPF1-p->dAPF1); mem(p->mRAPF1) = Rout; Rout = Rout * p->vAPF1 + mem(p->mRAPF1-p->dAPF1);
+
+        // late reverb APF2
+        Lout -= p->vAPF2 * mem(p->mLAPF2-p->dAPF2); mem(p->mLAPF2) = Lout; Lout = Lout * p->vAPF2 + mem(p->mLAPF2-p->dAPF2);
+        Rout -= p->vAPF2 * mem(p->mRAPF2-p->dAPF2); mem(p->mRAPF2) = Rout; Rout = Rout * p->vAPF2 + mem(p->mRAPF2-p->dAPF2);
+    }
+#undef mem
+
+    // output to mixer
+    *LeftOutput  = Lout;
+    *RightOutput = Rout;
+
+    net->BufferAddress = ((net->BufferAddress + 1) & rev->spu_buffer_count_mask);
+}
+
+#ifdef PSX_REV_SIMD
+#ifdef PSX_REV_SIMD_SSE2
+typedef __m128 v4f;
+#define v4f_dup(a)      _mm_set1_ps(a)
+#define v4f_add(a, b)   _mm_add_ps(a, b)
+#define v4f_sub(a, b)   _mm_sub_ps(a, b)
+#define v4f_mul(a, b)   _mm_mul_ps(a, b)
+#define v4f_store(p, a) _mm_storeu_ps(p, a)
+static inline v4f v4f_set2(float a, float b) {
+    return _mm_unpacklo_ps(_mm_set_ss(a), _mm_set_ss(b));
+}
+static inline v4f v4f_set4(float a, float b, float c, float d) {
+    return _mm_movelh_ps(v4f_set2(a, b), v4f_set2(c, d));
+}
+#else
+typedef float32x4_t v4f;
+#define v4f_dup(a)      vdupq_n_f32(a)
+#define v4f_add(a, b)   vaddq_f32(a, b)
+#define v4f_sub(a, b)   vsubq_f32(a, b)
+#define v4f_mul(a, b)   vmulq_f32(a, b)
+#define v4f_store(p, a) vst1q_f32(p, a)
+static inline v4f v4f_set4(float a, float b, float c, float d) {
+    const float v[4] = { a, b, c, d };
+    return vld1q_f32(v);
+}
+static inline v4f v4f_set2(float a, float b) {
+    return v4f_set4(a, b, 0.0f, 0.0f);
+}
+#endif
+
+/**
+   Same network as `spu_reverb_step()`, but the SAME/DIFF reflections of both
+   sides run as one 4 lane operation and the COMB and APF stages as one 2 lane
+   operation.  The operation order per lane is the same as in the scalar
+   kernel, so results are bit exact unless the compiler contracts the scalar
+   code to FMA (the build passes `-ffp-contract=off` for that reason).
+
+   The vector kernel reads all lanes of a stage before writing any of them,
+   while the scalar kernel writes each lane before reading the next one.  For
+   presets where a lane reads what an earlier lane of the same stage wrote
+   (e.g. the zero DIFF offsets of Room), `simd_lanes_check()` flags the lanes
+   that have to be recomputed after the earlier writes or the APF stages that
+   have to run scalar.
+*/
+static inline void
+spu_reverb_step_simd(PsxReverb *rev, PsxReverbNetwork *net, float Lin, float Rin, float *LeftOutput, float *RightOutput)
+{
+    const PsxReverbParams *p = rev->params;
+    float *buf = net->buffer;
+    const uint32_t base = net->BufferAddress;
+    const uint32_t mask = (uint32_t)rev->spu_buffer_count_mask;
+    float tmp[4];
+
+#define mem(idx) buf[((idx) + base) & mask]
+    // same and different side reflection
+    const v4f in   = v4f_set4(Lin, Rin, Lin, Rin);
+    const v4f wall = v4f_set4(mem(p->dLSAME), mem(p->dRSAME), mem(p->dRDIFF), mem(p->dLDIFF));
+    const v4f prev = v4f_set4(mem(p->mLSAME-1), mem(p->mRSAME-1), mem(p->mLDIFF-1), mem(p->mRDIFF-1));
+    const v4f refl = v4f_add(v4f_mul(v4f_sub(v4f_add(in, v4f_mul(wall, v4f_dup(p->vWALL))), prev), v4f_dup(p->vIIR)), prev);
+    v4f_store(tmp, refl);
+    if (p->simd_fixup == 0) {
+        mem(p->mLSAME) = tmp[0];
+        mem(p->mRSAME) = tmp[1];
+        mem(p->mLDIFF) = tmp[2];
+        mem(p->mRDIFF) = tmp[3];
+    } else {
+        const float    x[4] = { Lin, Rin, Lin, Rin };
+        const uint32_t m[4] = { p->mLSAME, p->mRSAME, p->mLDIFF, p->mRDIFF };
+        const uint32_t d[4] = { p->dLSAME, p->dRSAME, p->dRDIFF, p->dLDIFF };
+        for (int i = 0; i < 4; i++) {
+            if (p->simd_fixup & (1u << i))
+                tmp[i] = (x[i] + mem(d[i]) * p->vWALL - mem(m[i]-1)) * p->vIIR + mem(m[i]-1);
+            mem(m[i]) = tmp[i];
+        }
+    }
+
+    // early echo
+    v4f out = v4f_mul(v4f_dup(p->vCOMB1), v4f_set2(mem(p->mLCOMB1), mem(p->mRCOMB1)));
+    out = v4f_add(out, v4f_mul(v4f_dup(p->vCOMB2), v4f_set2(mem(p->mLCOMB2), mem(p->mRCOMB2))));
+    out = v4f_add(out, v4f_mul(v4f_dup(p->vCOMB3), v4f_set2(mem(p->mLCOMB3), mem(p->mRCOMB3))));
+    out = v4f_add(out, v4f_mul(v4f_dup(p->vCOMB4), v4f_set2(mem(p->mLCOMB4), mem(p->mRCOMB4))));
+
+    // late reverb APF1 and APF2
+#define APF_STAGE(vAPF, mLAPF, mRAPF, dAPF, vector) \
+    if (vector) { \
+        const v4f coef = v4f_dup(vAPF); \
+        out = v4f_sub(out, v4f_mul(coef, v4f_set2(mem(mLAPF-dAPF), mem(mRAPF-dAPF)))); \
+        v4f_store(tmp, out); \
+        mem(mLAPF) = tmp[0]; \
+        mem(mRAPF) = tmp[1]; \
+        out = v4f_add(v4f_mul(out, coef), v4f_set2(mem(mLAPF-dAPF), mem(mRAPF-dAPF))); \
+    } else { \
+        v4f_store(tmp, out); \
+        tmp[0] -= vAPF * mem(mLAPF-dAPF); mem(mLAPF) = tmp[0]; tmp[0] = tmp[0] * vAPF + mem(mLAPF-dAPF); \
+        tmp[1] -= vAPF * mem(mRAPF-dAPF); mem(mRAPF) = tmp[1]; tmp[1] = tmp[1] * vAPF + mem(mRAPF-dAPF); \
+        out = v4f_set2(tmp[0], tmp[1]); \
+    }
+    APF_STAGE(p->vAPF1, p->mLAPF1, p->mRAPF1, p->dAPF1, p->simd_apf1)
+    APF_STAGE(p->vAPF2, p->mLAPF2, p->mRAPF2, p->dAPF2, p->simd_apf2)
+#undef APF_STAGE
+#undef mem
+
+    // output to mixer
+    v4f_store(tmp, out);
+    *LeftOutput  = tmp[0];
+    *RightOutput = tmp[1];
+
+    net->BufferAddress = ((net->BufferAddress + 1) & rev->spu_buffer_count_mask);
+}
+#endif
+
+/* find the vector lanes that depend on writes of earlier lanes of the same stage */
+static void
+simd_lanes_check(PsxReverbParams *p, uint32_t mask)
+{
+#define same(a, b) ((((a) - (b)) & mask) == 0)
+    const uint32_t w[4] = { p->mLSAME, p->mRSAME, p->mLDIFF, p->mRDIFF };
+    const uint32_t r[4][2] = {
+        { p->dLSAME, p->mLSAME - 1 },
+        { p->dRSAME, p->mRSAME - 1 },
+        { p->dRDIFF, p->mLDIFF - 1 },
+        { p->dLDIFF, p->mRDIFF - 1 },
+    };
+
+    p->simd_fixup = 0;
+    for (int j = 1; j < 4; j++) {
+        for (int i = 0; i < j; i++) {
+            if (same(w[i], r[j][0]) || same(w[i], r[j][1]))
+                p->simd_fixup |= (uint8_t)(1u << j);
+        }
+    }
+
+    p->simd_apf1 = !same(p->mLAPF1, p->mRAPF1 - p->dAPF1) && !same(p->mRAPF1, p->mLAPF1 - p->dAPF1);
+    p->simd_apf2 = !same(p->mLAPF2, p->mRAPF2 - p->dAPF2) && !same(p->mRAPF2, p->mLAPF2 - p->dAPF2);
+#undef same
+}
+
+static inline int16_t sat16(int32_t v) {
+    if (v < INT16_MIN)
+        return INT16_MIN;
+    if (v > INT16_MAX)
+        return INT16_MAX;
+    return (int16_t)v;
+}
+
+/* 1.15 fixed point multiplication, truncating like the SPU; sums of several taps can exceed 16 bit */
+static inline int32_t mul15(int32_t a, int32_t b) {
+    return (int32_t)(((int64_t)a * b) >> 15);
+}
+
+/**
+   Same network as `spu_reverb_step()`, but on a 16 bit buffer with fixed point
+   math the way the SPU does it: samples and gains are 1.15, products are
+   truncated, and everything written to the buffer as well as the result of
+   each APF stage saturates to 16 bit.  The buffer needs half the memory of
+   the float engines.
+*/
+static PSX_REV_INLINE void
+spu_reverb_step_fixed(PsxReverb *rev, PsxReverbNetwork *net, float Lin, float Rin, float *LeftOutput, float *RightOutput,
+                      const unsigned topo)
+{
+    const PsxReverbParams *p = rev->params;
+    int16_t *buf = (int16_t *)net->buffer;
+    const uint32_t base = net->BufferAddress;
+    const uint32_t mask = (uint32_t)rev->spu_buffer_count_mask;
+    const int32_t vIIR = p->fixed.vIIR;
+    const int32_t vWALL = p->fixed.vWALL;
+    const int32_t L = f2s(Lin);
+    const int32_t R = f2s(Rin);
+
+#define mem(idx) buf[((idx) + base) & mask]
+    // same side reflection
+    mem(p->mLSAME) = sat16(mul15(L + mul15(mem(p->dLSAME), vWALL) - mem(p->mLSAME-1), vIIR) + mem(p->mLSAME-1));
+    mem(p->mRSAME) = sat16(mul15(R + mul15(mem(p->dRSAME), vWALL) - mem(p->mRSAME-1), vIIR) + mem(p->mRSAME-1));
+
+    // different side reflection
+    if (!(topo & PSX_REV_TOPO_DIFF)) {
+        mem(p->mLDIFF) = sat16(mul15(L + mul15(mem(p->dRDIFF), vWALL) - mem(p->mLDIFF-1), vIIR) + mem(p->mLDIFF-1));
+        mem(p->mRDIFF) = sat16(mul15(R + mul15(mem(p->dLDIFF), vWALL) - mem(p->mRDIFF-1), vIIR) + mem(p->mRDIFF-1));
+    }
+
+    // early echo
+    int32_t Lout = mul15(p->fixed.vCOMB1, mem(p->mLCOMB1));
+    int32_t Rout = mul15(p->fixed.vCOMB1, mem(p->mRCOMB1));
+    if (!(topo & PSX_REV_TOPO_COMB2)) {
+        Lout += mul15(p->fixed.vCOMB2, mem(p->mLCOMB2));
+        Rout += mul15(p->fixed.vCOMB2, mem(p->mRCOMB2));
+    }
+    if (!(topo & PSX_REV_TOPO_COMB34)) {
+        Lout += mul15(p->fixed.vCOMB3, mem(p->mLCOMB3)) + mul15(p->fixed.vCOMB4, mem(p->mLCOMB4));
+        Rout += mul15(p->fixed.vCOMB3, mem(p->mRCOMB3)) + mul15(p->fixed.vCOMB4, mem(p->mRCOMB4));
+    }
+
+    if (topo & PSX_REV_TOPO_APF) {
+        // late reverb APF1 and APF2 without gain only saturate and delay
+        Lout = sat16(Lout); mem(p->mLAPF1) = (int16_t)Lout; Lout = mem(p->mLAPF1-p->dAPF1);
+        Rout = sat16(Rout); mem(p->mRAPF1) = (int16_t)Rout; Rout = mem(p->mRAPF1-p->dAPF1);
+        mem(p->mLAPF2) = (int16_t)Lout; Lout = mem(p->mLAPF2-p->dAPF2);
+        mem(p->mRAPF2) = (int16_t)Rout; Rout = mem(p->mRAPF2-p->dAPF2);
+    } else {
+        // late reverb APF1
+        Lout = sat16(Lout - mul15(p->fixed.vAPF1, mem(p->mLAPF1-p->dAPF1))); mem(p->mLAPF1) = (int16_t)Lout;
+        Lout = sat16(mul15(Lout, p->fixed.vAPF1) + mem(p->mLAPF1-p->dAPF1));
+        Rout = sat16(Rout - mul15(p->fixed.vAPF1, mem(p->mRAPF1-p->dAPF1))); mem(p->mRAPF1) = (int16_t)Rout;
+        Rout = sat16(mul15(Rout, p->fixed.vAPF1) + mem(p->mRAPF1-p->dAPF1));
+
+        // late reverb APF2
+        Lout = sat16(Lout - mul15(p->fixed.vAPF2, mem(p->mLAPF2-p->dAPF2))); mem(p->mLAPF2) = (int16_t)Lout;
+        Lout = sat16(mul15(Lout, p->fixed.vAPF2) + mem(p->mLAPF2-p->dAPF2));
+        Rout = sat16(Rout - mul15(p->fixed.vAPF2, mem(p->mRAPF2-p->dAPF2))); mem(p->mRAPF2) = (int16_t)Rout;
+        Rout = sat16(mul15(Rout, p->fixed.vAPF2) + mem(p->mRAPF2-p->dAPF2));
+    }
+#undef mem
+
+    // output to mixer
+    *LeftOutput  = s2f((int16_t)Lout);
+    *RightOutput = s2f((int16_t)Rout);
+
+    net->BufferAddress = ((net->BufferAddress + 1) & rev->spu_buffer_count_mask);
+}
+
+/* the vector kernel always runs every stage, presets that skip some do better with the scalar one */
+static PSX_REV_INLINE void
+reverb_step(PsxReverb *rev, PsxReverbNetwork *net, float Lin, float Rin, float *LeftOutput, float *RightOutput,
+            const unsigned topo)
+{
+#ifdef PSX_REV_SIMD
+    if (topo == 0) {
+        spu_reverb_step_simd(rev, net, Lin, Rin, LeftOutput, RightOutput);
+        return;
+    }
+#endif
+    spu_reverb_step(rev, net, Lin, Rin, LeftOutput, RightOutput, topo);
+}
+
+/* early echo of one side over a span */
+static PSX_REV_INLINE void
+lines_comb(const PsxReverbParams *p, float *restrict out, const float *restrict c1, const float *restrict c2,
+           const float *restrict c3, const float *restrict c4, uint32_t n, const unsigned topo, const uint32_t stride)
+{
+    const float vCOMB1 = p->vCOMB1;
+    const float vCOMB2 = p->vCOMB2;
+    const float vCOMB3 = p->vCOMB3;
+    const float vCOMB4 = p->vCOMB4;
+
+    for (uint32_t i = 0; i < n; i++) {
+        float sum = vCOMB1 * c1[i * stride];
+        if (!(topo & PSX_REV_TOPO_COMB2))
+            sum += vCOMB2 * c2[i * stride];
+        if (!(topo & PSX_REV_TOPO_COMB34))
+            sum = sum + vCOMB3 * c3[i * stride] + vCOMB4 * c4[i * stride];
+        out[i] = sum;
+    }
+}
+
+/* one APF of one side over a span, the reads are at least n samples behind the line write */
+static PSX_REV_INLINE void
+lines_apf(float vAPF, float *restrict io, float *restrict line, const float *restrict before,
+          const float *restrict after, uint32_t n, const unsigned topo, const uint32_t stride)
+{
+    if (topo & PSX_REV_TOPO_APF) {
+        for (uint32_t i = 0; i < n; i++) {
+            line[i * stride] = io[i];
+            io[i] = after[i * stride];
+        }
+        return;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        float out = io[i];
+        out -= vAPF * before[i * stride]; line[i * stride] = out; out = out * vAPF + after[i * stride];
+        io[i] = out;
+    }
+}
+
+/**
+   Run a span through the network one stage at a time: first the reflections
+   of all samples, then the early echo, then each APF.  This is only valid if
+   no stage reads anything a later stage or (except for the reflections) the
+   same stage wrote less than `n` samples ago, which `lines_layout()` checks
+   at preset load.  The reflections feed back
+   on themselves after one sample and stay a serial loop, but the early echo
+   and the APFs become plain array loops the compiler can vectorize.  Every
+   value is computed with the same operations as in the per sample loop, so
+   results are still bit exact.
+*/
+static PSX_REV_INLINE void
+lines_span_staged(const PsxReverbParams *p, float *const *w, const float *const *r,
+                  const float *in0, const float *in1, float *out0, float *out1, uint32_t n, const unsigned topo,
+                  const uint32_t stride)
+{
+    // same and different side reflection
+    for (uint32_t i = 0; i < n; i++) {
+        const float Lin = in0[i];
+        const float Rin = in1[i];
+        w[LINE_LSAME][i * stride] = (Lin + r[READ_dLSAME][i * stride] * p->vWALL - r[READ_mLSAME_PREV][i * stride]) * p->vIIR + r[READ_mLSAME_PREV][i * stride];
+        w[LINE_RSAME][i * stride] = (Rin + r[READ_dRSAME][i * stride] * p->vWALL - r[READ_mRSAME_PREV][i * stride]) * p->vIIR + r[READ_mRSAME_PREV][i * stride];
+        if (!(topo & PSX_REV_TOPO_DIFF)) {
+            w[LINE_LDIFF][i * stride] = (Lin + r[READ_dRDIFF][i * stride] * p->vWALL - r[READ_mLDIFF_PREV][i * stride]) * p->vIIR + r[READ_mLDIFF_PREV][i * stride];
+            w[LINE_RDIFF][i * stride] = (Rin + r[READ_dLDIFF][i * stride] * p->vWALL - r[READ_mRDIFF_PREV][i * stride]) * p->vIIR + r[READ_mRDIFF_PREV][i * stride];
+        }
+    }
+
+    // early echo, in0/in1 may be the same arrays as out0/out1 but are not needed anymore
+    lines_comb(p, out0, r[READ_mLCOMB1], r[READ_mLCOMB2], r[READ_mLCOMB3], r[READ_mLCOMB4], n, topo, stride);
+    lines_comb(p, out1, r[READ_mRCOMB1], r[READ_mRCOMB2], r[READ_mRCOMB3], r[READ_mRCOMB4], n, topo, stride);
+
+    // late reverb APF1
+    lines_apf(p->vAPF1, out0, w[LINE_LAPF1], r[READ_LAPF1_IN], r[READ_LAPF1_OUT], n, topo, stride);
+    lines_apf(p->vAPF1, out1, w[LINE_RAPF1], r[READ_RAPF1_IN], r[READ_RAPF1_OUT], n, topo, stride);
+
+    // late reverb APF2
+    lines_apf(p->vAPF2, out0, w[LINE_LAPF2], r[READ_LAPF2_IN], r[READ_LAPF2_OUT], n, topo, stride);
+    lines_apf(p->vAPF2, out1, w[LINE_RAPF2], r[READ_RAPF2_IN], r[READ_RAPF2_OUT], n, topo, stride);
+}
+
+/**
+   Same network as `spu_reverb_step()`, but every register the network writes
+   has a delay line of its own and every read is resolved at preset load time
+   to the line and age of the value the shared buffer would return, see
+   `lines_layout()`.  The lines are not masked per access: the chunk is split
+   into spans in which no line wraps around, which leaves plain pointer
+   increments for the inner loop.  The operation order is the same as in the
+   scalar kernel, so results are bit exact.  Spans the preset's loop delays
+   allow are run stage by stage with `lines_span_staged()` instead.
+*/
+static PSX_REV_INLINE void
+lines_block(PsxReverb *rev, PsxReverbNetwork *net, const float *in0, const float *in1, float *out0, float *out1, uint32_t n,
+            const unsigned topo, const uint32_t stride)
+{
+    const PsxReverbParams *p = rev->params;
+    const PsxReverbLines *l = &p->lines;
+    float *buf = net->buffer;
+
+    while (n > 0) {
+        float *w[NUM_LINES];
+        const float *r[NUM_READS];
+        uint32_t span = n;
+
+        for (int i = 0; i < NUM_LINES; i++) {
+            const uint32_t pos = net->lines_time & l->mask[i];
+            w[i] = buf + l->base[i] + pos * stride;
+            if (span > l->mask[i] + 1 - pos)
+                span = l->mask[i] + 1 - pos;
+        }
+        for (int i = 0; i < NUM_READS; i++) {
+            const int line = l->line[i];
+            const uint32_t pos = (net->lines_time - l->age[i]) & l->mask[line];
+            r[i] = buf + l->base[line] + pos * stride;
+            if (span > l->mask[line] + 1 - pos)
+                span = l->mask[line] + 1 - pos;
+        }
+
+        if (span <= l->staged_span) {
+            lines_span_staged(p, w, r, in0, in1, out0, out1, span, topo, stride);
+        } else for (uint32_t i = 0; i < span; i++) {
+            const float Lin = in0[i];
+            const float Rin = in1[i];
+
+            // same side reflection
+            w[LINE_LSAME][i * stride] = (Lin + r[READ_dLSAME][i * stride] * p->vWALL - r[READ_mLSAME_PREV][i * stride]) * p->vIIR + r[READ_mLSAME_PREV][i * stride];
+            w[LINE_RSAME][i * stride] = (Rin + r[READ_dRSAME][i * stride] * p->vWALL - r[READ_mRSAME_PREV][i * stride]) * p->vIIR + r[READ_mRSAME_PREV][i * stride];
+
+            // different side reflection
+            if (!(topo & PSX_REV_TOPO_DIFF)) {
+                w[LINE_LDIFF][i * stride] = (Lin + r[READ_dRDIFF][i * stride] * p->vWALL - r[READ_mLDIFF_PREV][i * stride]) * p->vIIR + r[READ_mLDIFF_PREV][i * stride];
+                w[LINE_RDIFF][i * stride] = (Rin + r[READ_dLDIFF][i * stride] * p->vWALL - r[READ_mRDIFF_PREV][i * stride]) * p->vIIR + r[READ_mRDIFF_PREV][i * stride];
+            }
+
+            // early echo
+            float Lout = p->vCOMB1 * r[READ_mLCOMB1][i * stride];
+            float Rout = p->vCOMB1 * r[READ_mRCOMB1][i * stride];
+            if (!(topo & PSX_REV_TOPO_COMB2)) {
+                Lout += p->vCOMB2 * r[READ_mLCOMB2][i * stride];
+                Rout += p->vCOMB2 * r[READ_mRCOMB2][i * stride];
+            }
+            if (!(topo & PSX_REV_TOPO_COMB34)) {
+                Lout = Lout + p->vCOMB3 * r[READ_mLCOMB3][i * stride] + p->vCOMB4 * r[READ_mLCOMB4][i * stride];
+                Rout = Rout + p->vCOMB3 * r[READ_mRCOMB3][i * stride] + p->vCOMB4 * r[READ_mRCOMB4][i * stride];
+            }
+
+            if (topo & PSX_REV_TOPO_APF) {
+                // late reverb APF1 and APF2 without gain only delay
+                w[LINE_LAPF1][i * stride] = Lout; Lout = r[READ_LAPF1_OUT][i * stride];
+                w[LINE_RAPF1][i * stride] = Rout; Rout = r[READ_RAPF1_OUT][i * stride];
+                w[LINE_LAPF2][i * stride] = Lout; Lout = r[READ_LAPF2_OUT][i * stride];
+                w[LINE_RAPF2][i * stride] = Rout; Rout = r[READ_RAPF2_OUT][i * stride];
+            } else {
+                // late reverb APF1
+                Lout -= p->vAPF1 * r[READ_LAPF1_IN][i * stride]; w[LINE_LAPF1][i * stride] = Lout; Lout = Lout * p->vAPF1 + r[READ_LAPF1_OUT][i * stride];
+                Rout -= p->vAPF1 * r[READ_RAPF1_IN][i * stride]; w[LINE_RAPF1][i * stride] = Rout; Rout = Rout * p->vAPF1 + r[READ_RAPF1_OUT][i * stride];
+
+                // late reverb APF2
+                Lout -= p->vAPF2 * r[READ_LAPF2_IN][i * stride]; w[LINE_LAPF2][i * stride] = Lout; Lout = Lout * p->vAPF2 + r[READ_LAPF2_OUT][i * stride];
+                Rout -= p->vAPF2 * r[READ_RAPF2_IN][i * stride]; w[LINE_RAPF2][i * stride] = Rout; Rout = Rout * p->vAPF2 + r[READ_RAPF2_OUT][i * stride];
+            }
+
+            out0[i] = Lout;
+            out1[i] = Rout;
+        }
+
+        net->lines_time += span;
+        in0 += span;
+        in1 += span;
+        out0 += span;
+        out1 += span;
+        n -= span;
+    }
+}
+
+/**
+   Resolve every read of the network to the line and age of the value it
+   returns from the shared buffer of `mask + 1` samples.  A read sees the
+   most recent write to its address: the smallest age, and of two writes in
+   the same sample the later one.  Writes that come after the read in the
+   same sample are one buffer cycle old.
+*/
+static void
+lines_layout(PsxReverbParams *p, uint32_t mask)
+{
+    /* written registers and reads in program order, with the writes done before each read */
+    const uint32_t m[NUM_LINES] = {
+        p->mLSAME, p->mRSAME, p->mLDIFF, p->mRDIFF, p->mLAPF1, p->mRAPF1, p->mLAPF2, p->mRAPF2,
+    };
+    const struct { uint32_t addr; int written; } reads[NUM_READS] = {
+        { p->dLSAME, 0 }, { p->mLSAME - 1, 0 }, { p->dRSAME, 1 }, { p->mRSAME - 1, 1 },
+        { p->dRDIFF, 2 }, { p->mLDIFF - 1, 2 }, { p->dLDIFF, 3 }, { p->mRDIFF - 1, 3 },
+        { p->mLCOMB1, 4 }, { p->mLCOMB2, 4 }, { p->mLCOMB3, 4 }, { p->mLCOMB4, 4 },
+        { p->mRCOMB1, 4 }, { p->mRCOMB2, 4 }, { p->mRCOMB3, 4 }, { p->mRCOMB4, 4 },
+        { p->mLAPF1 - p->dAPF1, 4 }, { p->mLAPF1 - p->dAPF1, 5 },
+        { p->mRAPF1 - p->dAPF1, 5 }, { p->mRAPF1 - p->dAPF1, 6 },
+        { p->mLAPF2 - p->dAPF2, 6 }, { p->mLAPF2 - p->dAPF2, 7 },
+        { p->mRAPF2 - p->dAPF2, 7 }, { p->mRAPF2 - p->dAPF2, 8 },
+    };
+    /* stage of each line and read for lines_span_staged() */
+    static const int line_stage[NUM_LINES] = { 0, 0, 0, 0, 2, 2, 3, 3 };
+    static const int read_stage[NUM_READS] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+    };
+    uint32_t longest[NUM_LINES] = { 0 };
+    PsxReverbLines *l = &p->lines;
+
+    l->staged_span = UINT32_MAX;
+    for (int i = 0; i < NUM_READS; i++) {
+        uint32_t best_age = UINT32_MAX;
+        int best = 0;
+        for (int j = 0; j < NUM_LINES; j++) {
+            uint32_t age = (m[j] - reads[i].addr) & mask;
+            if (age == 0 && j >= reads[i].written)
+                age = mask + 1;
+            if (age <= best_age) {
+                best_age = age;
+                best = j;
+            }
+        }
+        l->line[i] = (uint8_t)best;
+        l->age[i] = best_age;
+        if (longest[best] < best_age)
+            longest[best] = best_age;
+        /* a stage running ahead must not read values a later stage hasn't written yet,
+           and the APF stages only run as array loops if they don't feed back within a span */
+        const bool ahead = line_stage[best] > read_stage[i];
+        const bool feedback = line_stage[best] == read_stage[i] && read_stage[i] > 0;
+        if ((ahead || feedback) && l->staged_span > best_age)
+            l->staged_span = best_age;
+    }
+
+    /* lines have room for a span more than the longest age, so a stage running
+       ahead doesn't overwrite values later stages still read.  Interleaved
+       lines take the size of the longer side. */
+    l->count = 0;
+    for (uint32_t j = 0; j < NUM_LINES; j += PSX_REV_LINES_STRIDE) {
+        uint32_t size = PSX_REV_LINE_MIN;
+        for (uint32_t k = j; k < j + PSX_REV_LINES_STRIDE; k++) {
+            const uint32_t need = ceilpower2(longest[k] + PSX_REV_CHUNK);
+            if (size < need)
+                size = need;
+        }
+        for (uint32_t k = j; k < j + PSX_REV_LINES_STRIDE; k++) {
+            l->base[k] = (uint32_t)(l->count + k - j);
+            l->mask[k] = size - 1;
+        }
+        l->count += (size_t)size * PSX_REV_LINES_STRIDE;
+    }
+}
+
+/**
+   Find the stages of the network a preset doesn't need.  Taps with a gain of
+   0 only add zeros and APFs with a gain of 0 are plain delays.  The different
+   side reflection is dead if no other stage reads a value it wrote, which
+   `lines_layout()` has worked out for every read.  Leaving these out changes
+   at most the sign of a zero in the output.  With all comb gains at 0 only
+   zeros ever reach the APFs and the output.
+*/
+static void
+topology_check(PsxReverbParams *p)
+{
+    const PsxReverbLines *l = &p->lines;
+    unsigned topo = 0;
+
+    if (p->vCOMB1 == 0.0f && p->vCOMB2 == 0.0f && p->vCOMB3 == 0.0f && p->vCOMB4 == 0.0f) {
+        p->topology = PSX_REV_TOPO_SILENT;
+        return;
+    }
+    if (p->vCOMB2 == 0.0f)
+        topo |= PSX_REV_TOPO_COMB2;
+    if (p->vCOMB3 == 0.0f && p->vCOMB4 == 0.0f)
+        topo |= PSX_REV_TOPO_COMB34;
+    if (p->vAPF1 == 0.0f && p->vAPF2 == 0.0f)
+        topo |= PSX_REV_TOPO_APF;
+
+    topo |= PSX_REV_TOPO_DIFF;
+    for (int i = 0; i < NUM_READS; i++) {
+        const bool own = i >= READ_dRDIFF && i <= READ_mRDIFF_PREV;
+        const bool skipped =
+            ((topo & PSX_REV_TOPO_COMB2) && (i == READ_mLCOMB2 || i == READ_mRCOMB2)) ||
+            ((topo & PSX_REV_TOPO_COMB34) && (i == READ_mLCOMB3 || i == READ_mLCOMB4 ||
+                                              i == READ_mRCOMB3 || i == READ_mRCOMB4)) ||
+            ((topo & PSX_REV_TOPO_APF) && (i == READ_LAPF1_IN || i == READ_RAPF1_IN ||
+                                           i == READ_LAPF2_IN || i == READ_RAPF2_IN));
+        if (!own && !skipped && (l->line[i] == LINE_LDIFF || l->line[i] == LINE_RDIFF))
+            topo &= ~PSX_REV_TOPO_DIFF;
+    }
+    p->topology = (uint8_t)topo;
+}
+
+/**
+   Drop the DIFF cross-feed for the eco engine if the combs take little of
+   their input from it.  Its lines then stay clear, so the combs reading them
+   only get the SAME reflections.
+*/
+static void
+eco_reduce(PsxReverbParams *p)
+{
+    const float gain[4] = { fabsf(p->vCOMB1), fabsf(p->vCOMB2), fabsf(p->vCOMB3), fabsf(p->vCOMB4) };
+    float diff = 0.0f;
+    float all = 0.0f;
+
+    for (int i = READ_mLCOMB1; i <= READ_mRCOMB4; i++) {
+        const float g = gain[(i - READ_mLCOMB1) % 4];
+        all += g;
+        if (p->lines.line[i] == LINE_LDIFF || p->lines.line[i] == LINE_RDIFF)
+            diff += g;
+    }
+    if (!(p->topology & PSX_REV_TOPO_SILENT) && diff <= PSX_REV_ECO_DIFF * all)
+        p->topology |= PSX_REV_TOPO_DIFF;
+}
+
+/* floats of buffer the engine needs for a preset on an SPU buffer of `samples` */
+static size_t
+engine_buffer_count(const PsxReverbParams *p, PsxReverbEngine engine, size_t samples)
+{
+    switch (engine) {
+    case PSX_REV_ENGINE_LINES:
+        return p->lines.count;
+    case PSX_REV_ENGINE_FIXED:
+        return (samples * sizeof(int16_t) + sizeof(float) - 1) / sizeof(float);
+    default:
+        return samples;
+    }
+}
+
+/* part of each network's buffer an engine reads with a preset, the mask is the preset's if sized per preset */
+static size_t
+engine_buffer_used(const PsxReverb *rev, const PsxReverbParams *p, PsxReverbEngine engine)
+{
+    return engine_buffer_count(p, engine, rev->spu_buffer_resize ? p->buffer_count : rev->spu_buffer_count_mask + 1);
+}
+
+/**
+   Clear what an engine reading the first `used` floats of each network's
+   buffer needs cleared.  Only the first `dirty` floats may have been written
+   since the buffer was allocated or last cleared, so a fresh buffer isn't
+   touched at all.  Returns the new high-water mark of written data.
+*/
+static size_t
+buffer_clear(float *buffer, size_t stride, uint32_t pairs, size_t dirty, size_t used)
+{
+    const size_t n = dirty < used ? dirty : used;
+
+    for (uint32_t k = 0; k < pairs; k++)
+        memset(buffer + k * stride, 0, n * sizeof(buffer[0]));
+    return dirty > used ? dirty : 0;
+}
+
+/**
+   Clear the buffer of the crossfade networks outside of `run()`.  It may be
+   the one the instance used before the crossfade, so it is replaced by one
+   that fits every preset built in if it is smaller.
+*/
+static void
+fade_buffer_prepare(const PsxReverb *rev, float **buffer, size_t *count, size_t *dirty)
+{
+    if (*count < rev->fade_count) {
+        float *fit = calloc(rev->fade_count * rev->variant->pairs, sizeof(float));
+        if (fit) {
+            free(*buffer);
+            *buffer = fit;
+            *count = rev->fade_count;
+            *dirty = 0;
+        }
+    }
+    *dirty = buffer_clear(*buffer, *count, rev->variant->pairs, *dirty, *count);
+}
+
+/* run n samples through the reverb network with the engine in use, specialized for `topo` */
+static PSX_REV_INLINE void
+network_block_topo(PsxReverb *rev, PsxReverbNetwork *net, const float *in0, const float *in1, float *out0, float *out1,
+                   uint32_t n, const unsigned topo)
+{
+    if (rev->kernel == PSX_REV_ENGINE_LINES) {
+        lines_block(rev, net, in0, in1, out0, out1, n, topo, PSX_REV_LINES_STRIDE);
+        return;
+    }
+    if (rev->kernel == PSX_REV_ENGINE_FIXED) {
+        for (uint32_t i = 0; i < n; i++)
+            spu_reverb_step_fixed(rev, net, in0[i], in1[i], &out0[i], &out1[i], topo);
+        return;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+        reverb_step(rev, net, in0[i], in1[i], &out0[i], &out1[i], topo);
+}
+
+/* run n samples through the reverb network with the kernel for the preset's topology */
+static void
+network_block(PsxReverb *rev, PsxReverbNetwork *net, const float *in0, const float *in1, float *out0, float *out1, uint32_t n)
+{
+    const unsigned topo = rev->params->topology;
+
+    /* nothing is read, but the buffer position still moves on like for any other preset */
+    if (topo & PSX_REV_TOPO_SILENT) {
+        memset(out0, 0, n * sizeof(out0[0]));
+        memset(out1, 0, n * sizeof(out1[0]));
+        net->BufferAddress = (uint32_t)((net->BufferAddress + n) & rev->spu_buffer_count_mask);
+        net->lines_time += n;
+        return;
+    }
+
+    switch (topo) {
+#define TOPOLOGY(t) \
+    case t: \
+        network_block_topo(rev, net, in0, in1, out0, out1, n, t); \
+        break;
+    PSX_REV_TOPOLOGIES(TOPOLOGY)
+#undef TOPOLOGY
+    }
+}
+
+static void
+preset_switch_done(PsxReverb *rev, const PsxReverbParams *params, PsxReverbEngine engine,
+                   float *buffer, size_t buffer_count, size_t buffer_dirty)
+{
+    rev->params = params;
+    rev->kernel = engine;
+    rev->spu_buffer = buffer;
+    rev->spu_buffer_count = buffer_count;
+    if (rev->spu_buffer_resize)
+        rev->spu_buffer_count_mask = params->buffer_count - 1;
+    rev->spu_buffer_used = engine_buffer_used(rev, params, engine);
+    rev->spu_buffer_dirty = buffer_dirty;
+    networks_reset(rev);
+    rev->pending = NULL;
+    rev->switching = false;
+    rev->stats.last.reloads++;
+}
+
+/* map the preset port to a table index, out of range values are clamped */
+static int
+preset_index(PsxReverb *rev, int request)
+{
+    if (request != rev->preset_request) {
+        rev->preset_request = request;
+        rev->custom_selected = false;
+        if (request < 0 || request >= NUM_PRESETS)
+            lv2_log_error(&rev->logger, "Invalid Preset: %d\n", request);
+    }
+
+    if (request < 0)
+        return 0;
+    if (request >= NUM_PRESETS)
+        return NUM_PRESETS - 1;
+    return request;
+}
+
+/* map the engine port to an engine, out of range values are clamped */
+static PsxReverbEngine
+engine_index(float value)
+{
+    const int engine = (int)value;
+
+    if (engine < 0)
+        return (PsxReverbEngine)0;
+    if (engine >= NUM_ENGINES)
+        return (PsxReverbEngine)(NUM_ENGINES - 1);
+    return (PsxReverbEngine)engine;
+}
+
+/* converted parameters of a preset, the custom preset uses the set it was last converted into */
+static const PsxReverbParams *
+preset_params(const PsxReverb *rev, bool native, PsxReverbEngine engine, int preset)
+{
+    const unsigned row = network_row(native, engine);
+
+    if (preset == PSX_REV_PRESET_CUSTOM)
+        return &rev->custom[rev->custom_slot][row];
+    return &rev->param_table[row][preset];
+}
+
+/**
+   `state_save()` may copy the buffer while `run()` is processing, but not
+   while it is being switched.  Either it sees `switching` set and doesn't
+   save the tail, or `run()` sees `saving` set and tries again next block.
+*/
+static bool
+switch_begin(PsxReverb *rev)
+{
+    /* networks threads are still running can't be switched, try again next block */
+    if (pool_late(rev))
+        return false;
+#ifdef PSX_REV_ATOMICS
+    __atomic_store_n(&rev->switching, true, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&rev->saving, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&rev->switching, false, __ATOMIC_SEQ_CST);
+        return false;
+    }
+#endif
+    return true;
+}
+
+/**
+   Start switching to another preset, network rate or engine from `run()`.
+   All presets are converted at instantiation, so only the SPU buffer has to
+   be cleared.  This is done by the worker if the host provides one,
+   otherwise in chunks over the next blocks.  Until the buffer is clear, the
+   reverb network doesn't run.
+*/
+static void
+preset_switch(PsxReverb *rev, int preset, bool native, PsxReverbEngine engine)
+{
+    rev->preset = preset;
+    rev->native = native;
+    rev->engine = engine;
+    rev->switching = true;
+
+    const PsxReverbWork work = {
+        PSX_REV_WORK_SWITCH, preset_params(rev, native, engine, preset), engine,
+        rev->spu_buffer, rev->spu_buffer_count, rev->spu_buffer_dirty
+    };
+    if (rev->schedule &&
+        rev->schedule->schedule_work(rev->schedule->handle, sizeof(work), &work) == LV2_WORKER_SUCCESS)
+        return;
+
+    rev->pending = work.params;
+    rev->clear_pos = 0;
+}
+
+/* clear the next chunk of the SPU buffer if switching without a worker, like buffer_clear() */
+static void
+preset_clear_step(PsxReverb *rev)
+{
+    const size_t used = engine_buffer_used(rev, rev->pending, rev->engine);
+    const size_t dirty = rev->spu_buffer_dirty;
+    const size_t clear = dirty < used ? dirty : used;
+    const size_t count = rev->variant->pairs * clear;
+
+    if (rev->clear_pos < count) {
+        const size_t offset = rev->clear_pos % clear;
+        size_t n = clear - offset;
+        if (n > PSX_REV_CLEAR_CHUNK)
+            n = PSX_REV_CLEAR_CHUNK;
+
+        memset(rev->spu_buffer + rev->clear_pos / clear * rev->spu_buffer_count + offset, 0,
+               n * sizeof(rev->spu_buffer[0]));
+        rev->clear_pos += n;
+    }
+
+    if (rev->clear_pos == count)
+        preset_switch_done(rev, rev->pending, rev->engine, rev->spu_buffer, rev->spu_buffer_count,
+                           dirty > used ? dirty : 0);
+}
+
+/* check if any sample is above the silence threshold, usually the first one is */
+static bool
+audible(const float *x, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        if (fabsf(x[i]) > PSX_REV_SILENCE)
+            return true;
+    }
+    return false;
+}
+
+/**
+   A network is idle once input and wet output stayed below `PSX_REV_SILENCE`
+   for longer than anything stays in its memory, everything left in there
+   would have shown up in the output by then.  The network is skipped while
+   idle, its state is kept as it is and only decays further once input comes
+   back, so there is no jump in the tail.
+*/
+static bool
+network_idle(const PsxReverb *rev, PsxReverbNetwork *net, const float *in0, const float *in1, uint32_t n)
+{
+    if (audible(in0, n) || (in0 != in1 && audible(in1, n))) {
+        net->quiet = 0;
+        return false;
+    }
+    return net->quiet >= rev->tail;
+}
+
+static void
+network_track(const PsxReverb *rev, PsxReverbNetwork *net, const float *wet0, const float *wet1, uint32_t n)
+{
+    if (audible(wet0, n) || audible(wet1, n))
+        net->quiet = 0;
+    else if (net->quiet < rev->tail)
+        net->quiet += n;
+}
+
+/* run a chunk through a reverb network, the wet signal goes to wet0/wet1, returns false if it was skipped */
+static bool
+process_network(PsxReverb *rev, PsxReverbNetwork *net, const float *in0, const float *in1,
+                float *wet0, float *wet1, uint32_t n)
+{
+    const float vLIN = rev->params->vLIN;
+    const float vRIN = rev->params->vRIN;
+    float x0[PSX_REV_CHUNK];
+    float x1[PSX_REV_CHUNK];
+
+    if (rev->switching || network_idle(rev, net, in0, in1, n)) {
+        memset(wet0, 0, n * sizeof(wet0[0]));
+        memset(wet1, 0, n * sizeof(wet1[0]));
+        return false;
+    }
+
+    if (rev->native) {
+        /* decimate the chunk, run the network on it and interpolate the result */
+        PsxResampler *rs = &net->resampler;
+        uint32_t m = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (resampler_push(rs, vLIN * in0[i], vRIN * in1[i], &x0[m], &x1[m]))
+                m++;
+        }
+
+        network_block(rev, net, x0, x1, x0, x1, m);
+
+        m = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (resampler_tick(rs)) {
+                resampler_put(rs, x0[m], x1[m]);
+                m++;
+            }
+            resampler_pull(rs, &wet0[i], &wet1[i]);
+        }
+    } else if (rev->kernel == PSX_REV_ENGINE_ECO) {
+        /* the same at the eco rate, with the cheap filters */
+        PsxEco *eco = &net->eco;
+        uint32_t m = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (eco_push(eco, vLIN * in0[i], vRIN * in1[i], &x0[m], &x1[m]))
+                m++;
+        }
+
+        network_block(rev, net, x0, x1, x0, x1, m);
+
+        m = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (eco_tick(eco)) {
+                eco_put(eco, x0[m], x1[m]);
+                m++;
+            }
+            eco_pull(eco, &wet0[i], &wet1[i]);
+        }
+    } else if (in0 == in1 && vLIN == vRIN) {
+        /* a mono input feeds both sides the same signal */
+        for (uint32_t i = 0; i < n; i++)
+            x0[i] = vLIN * in0[i];
+        network_block(rev, net, x0, x0, wet0, wet1, n);
+    } else {
+        for (uint32_t i = 0; i < n; i++) {
+            x0[i] = vLIN * in0[i];
+            x1[i] = vRIN * in1[i];
+        }
+        network_block(rev, net, x0, x1, wet0, wet1, n);
+    }
+
+    network_track(rev, net, wet0, wet1, n);
+    return true;
+}
+
+/* the buffer has to be cleared before the next switch once a network ran, see preset_clear_step() */
+static void
+process_dirty(PsxReverb *rev)
+{
+    if (rev->spu_buffer_dirty < rev->spu_buffer_used)
+        rev->spu_buffer_dirty = rev->spu_buffer_used;
+}
+
+/* smoothed gains of a chunk, the same for all networks */
+typedef struct {
+    bool  ramp;
+    float wet, wet_step;
+    float dry, dry_step;
+    float master, master_step;
+} PsxMix;
+
+static void
+mix_prepare(PsxReverb *rev, PsxMix *mix, uint32_t n)
+{
+    mix->ramp = gain_ramp(&rev->wet, rev->gain_decay, n, &mix->wet, &mix->wet_step);
+    mix->ramp |= gain_ramp(&rev->dry, rev->gain_decay, n, &mix->dry, &mix->dry_step);
+    mix->ramp |= gain_ramp(&rev->master, rev->gain_decay, n, &mix->master, &mix->master_step);
+}
+
+/* mix wet and dry signal of a chunk with the smoothed gains */
+static void
+process_mix(const PsxReverbParams *params, const PsxMix *mix, const float *in0, const float *in1,
+            const float *wet0, const float *wet1, float *out0, float *out1, uint32_t n)
+{
+    const float vLIN = params->vLIN;
+    const float vRIN = params->vRIN;
+    const float wet = mix->wet, wet_step = mix->wet_step;
+    const float dry = mix->dry, dry_step = mix->dry_step;
+    const float master = mix->master, master_step = mix->master_step;
+
+    if (!mix->ramp) {
+        for (uint32_t i = 0; i < n; i++) {
+            const float Lin = vLIN * in0[i];
+            const float Rin = vRIN * in1[i];
+            out0[i] = (wet0[i] * wet + Lin * dry) * master;
+            out1[i] = (wet1[i] * wet + Rin * dry) * master;
+        }
+        return;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        const float k = (float)(i + 1);
+        const float w = wet + k * wet_step;
+        const float d = dry + k * dry_step;
+        const float m = master + k * master_step;
+        const float Lin = vLIN * in0[i];
+        const float Rin = vRIN * in1[i];
+        out0[i] = (wet0[i] * w + Lin * d) * m;
+        out1[i] = (wet1[i] * w + Rin * d) * m;
+    }
+}
+
+/* crossfade length in host samples, 0 switches presets by clearing the buffer */
+static uint32_t
+fade_length(const PsxReverb *rev)
+{
+    const float ms = rev->crossfade;
+
+    if (!(ms > 0.0f))
+        return 0;
+    return (uint32_t)(fminf(ms, PSX_REV_CROSSFADE_MAX) * 0.001f * rev->rate) + 1;
+}
+
+/* exchange the networks and their buffer with the crossfade networks */
+static void
+fade_swap(PsxReverb *a, PsxReverb *b)
+{
+#define FADE_SWAP(type, field) { type t = a->field; a->field = b->field; b->field = t; }
+    FADE_SWAP(const PsxReverbParams *, params);
+    FADE_SWAP(PsxReverbEngine, kernel);
+    FADE_SWAP(bool, native);
+    FADE_SWAP(float *, spu_buffer);
+    FADE_SWAP(size_t, spu_buffer_count);
+    FADE_SWAP(size_t, spu_buffer_count_mask);
+    FADE_SWAP(size_t, spu_buffer_used);
+    FADE_SWAP(size_t, spu_buffer_dirty);
+    FADE_SWAP(uint32_t, tail);
+    for (uint32_t k = 0; k < a->variant->pairs; k++)
+        FADE_SWAP(PsxReverbNetwork, net[k]);
+#undef FADE_SWAP
+}
+
+/**
+   Start a crossfaded switch from `run()`.  The old preset moves on to the
+   crossfade networks with its tail, and the new one starts on their clear
+   buffer.  Both run until the crossfade is done, so nothing has to be cleared
+   before the new preset can be heard.  Like `preset_switch()`, this has to
+   follow a successful `switch_begin()`.
+*/
+static void
+fade_start(PsxReverb *rev, int preset, bool native, PsxReverbEngine engine, uint32_t len)
+{
+    fade_swap(rev, rev->fade);
+
+    rev->preset = preset;
+    rev->native = native;
+    rev->engine = engine;
+    rev->params = preset_params(rev, native, engine, preset);
+    rev->kernel = engine;
+    if (rev->spu_buffer_resize)
+        rev->spu_buffer_count_mask = rev->params->buffer_count - 1;
+    rev->spu_buffer_used = engine_buffer_used(rev, rev->params, engine);
+    networks_reset(rev);
+    rev->stats.last.reloads++;
+
+    rev->fade_pos = 0;
+    rev->fade_len = len;
+    rev->fade_state = PSX_REV_FADE_RUNNING;
+    rev->switching = false;
+}
+
+/* the old preset is faded out, its buffer is cleared by the worker or in run() */
+static void
+fade_end(PsxReverb *rev)
+{
+    PsxReverb *old = rev->fade;
+    const PsxReverbWork work = {
+        PSX_REV_WORK_FADE, NULL, old->kernel, old->spu_buffer, old->spu_buffer_count, old->spu_buffer_dirty
+    };
+
+    old->params = NULL;
+    if (rev->schedule &&
+        rev->schedule->schedule_work(rev->schedule->handle, sizeof(work), &work) == LV2_WORKER_SUCCESS) {
+        rev->fade_state = PSX_REV_FADE_WORKER;
+        return;
+    }
+    rev->fade_state = PSX_REV_FADE_CLEARING;
+    rev->fade_clear_pos = 0;
+}
+
+/**
+   Run the old preset on network `k` of the crossfade networks and fade its
+   wet signal over to the one of the new preset.  The tails of two presets
+   aren't correlated, so this keeps the power rather than the amplitude.  The
+   gains follow a quarter sine, ramped linearly in between chunks.
+*/
+static void
+fade_network(PsxReverb *rev, uint32_t k, const float *in0, const float *in1, float *wet0, float *wet1, uint32_t n)
+{
+    float old0[PSX_REV_CHUNK];
+    float old1[PSX_REV_CHUNK];
+
+    if (process_network(rev->fade, &rev->fade->net[k], in0, in1, old0, old1, n))
+        process_dirty(rev->fade);
+
+    const uint32_t end = rev->fade_pos + n < rev->fade_len ? rev->fade_pos + n : rev->fade_len;
+    const float x0 = (float)M_PI_2 * (float)rev->fade_pos / (float)rev->fade_len;
+    const float x1 = (float)M_PI_2 * (float)end / (float)rev->fade_len;
+    const float g_new = sinf(x0), g_old = cosf(x0);
+    const float new_step = (sinf(x1) - g_new) / (float)n;
+    const float old_step = (cosf(x1) - g_old) / (float)n;
+
+    for (uint32_t i = 0; i < n; i++) {
+        const float k_new = g_new + (float)(i + 1) * new_step;
+        const float k_old = g_old + (float)(i + 1) * old_step;
+        wet0[i] = wet0[i] * k_new + old0[i] * k_old;
+        wet1[i] = wet1[i] * k_new + old1[i] * k_old;
+    }
+}
+
+/* clear the next chunk of the crossfade networks' buffer without worker, like preset_clear_step() */
+static void
+fade_clear_step(PsxReverb *rev)
+{
+    PsxReverb *old = rev->fade;
+    const size_t clear = old->spu_buffer_dirty < old->spu_buffer_count ? old->spu_buffer_dirty : old->spu_buffer_count;
+    const size_t count = rev->variant->pairs * clear;
+
+    if (rev->fade_clear_pos < count) {
+        const size_t offset = rev->fade_clear_pos % clear;
+        size_t n = clear - offset;
+        if (n > PSX_REV_CLEAR_CHUNK)
+            n = PSX_REV_CLEAR_CHUNK;
+
+        memset(old->spu_buffer + rev->fade_clear_pos / clear * old->spu_buffer_count + offset, 0,
+               n * sizeof(old->spu_buffer[0]));
+        rev->fade_clear_pos += n;
+    }
+
+    if (rev->fade_clear_pos == count) {
+        old->spu_buffer_dirty = 0;
+        rev->fade_state = PSX_REV_FADE_IDLE;
+    }
+}
+
+/* stop a crossfade outside of run(), unless the worker still clears the buffer */
+static void
+fade_reset(PsxReverb *rev)
+{
+    PsxReverb *old = rev->fade;
+
+    if (rev->fade_state == PSX_REV_FADE_WORKER)
+        return;
+    old->params = NULL;
+    fade_buffer_prepare(rev, &old->spu_buffer, &old->spu_buffer_count, &old->spu_buffer_dirty);
+    rev->fade_state = PSX_REV_FADE_IDLE;
+}
+
+/**
+   When the input stops, the feedback paths of the network decay through
+   denormal floats which are very slow on most CPUs.  `run()` sets the FPU to
+   flush them to zero and restores the host's setting before returning.
+*/
+static uint64_t
+denormals_flush(void)
+{
+#if defined(PSX_REV_FTZ_SSE)
+    const unsigned int csr = _mm_getcsr();
+#if defined(__SSE2__) || defined(_M_X64)
+    _mm_setcsr(csr | 0x8040);   // FTZ | DAZ
+#else
+    _mm_setcsr(csr | 0x8000);   // FTZ, DAZ needs SSE2
+#endif
+    return csr;
+#elif defined(PSX_REV_FTZ_AARCH64)
+    uint64_t fpcr;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1u << 24)));   // FZ
+    return fpcr;
+#else
+    return 0;
+#endif
+}
+
+static void
+denormals_restore(uint64_t state)
+{
+#if defined(PSX_REV_FTZ_SSE)
+    _mm_setcsr((unsigned int)state);
+#elif defined(PSX_REV_FTZ_AARCH64)
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(state));
+#else
+    (void)state;
+#endif
+}
+
+/* chunks of a span the gains are worked out for up front, so the networks can run one after another */
+#define PSX_REV_BATCH 16
+
+typedef struct {
+    uint32_t offset;
+    uint32_t end;
+    PsxMix   mix[PSX_REV_BATCH];
+    bool     ran[PSX_REV_PAIRS_MAX];  // per network, if it wasn't skipped
+} PsxBatch;
+
+/* work out the gains of the chunks from `offset` on, up to `end` or a full batch */
+static void
+batch_prepare(PsxReverb *rev, PsxBatch *batch, uint32_t offset, uint32_t end)
+{
+    uint32_t c = 0;
+
+    batch->offset = offset;
+    while (offset < end && c < PSX_REV_BATCH) {
+        const uint32_t n = (end - offset < PSX_REV_CHUNK) ? end - offset : PSX_REV_CHUNK;
+        mix_prepare(rev, &batch->mix[c++], n);
+        offset += n;
+    }
+    batch->end = offset;
+}
+
+/**
+   Run network `k` over a batch and mix it into `out0`/`out1`, all buffers
+   start at the batch's first sample.  Returns false if the network was
+   skipped.  The networks only share state that doesn't change during a
+   block, so different ones can run on different threads.
+*/
+static bool
+pair_run(PsxReverb *rev, uint32_t k, const PsxBatch *batch, const float *in0, const float *in1,
+         float *out0, float *out1)
+{
+    float wet0[PSX_REV_CHUNK];
+    float wet1[PSX_REV_CHUNK];
+    const uint32_t len = batch->end - batch->offset;
+    bool ran = false;
+    uint32_t c = 0;
+
+    for (uint32_t i = 0; i < len; i += PSX_REV_CHUNK, c++) {
+        const uint32_t n = (len - i < PSX_REV_CHUNK) ? len - i : PSX_REV_CHUNK;
+
+        if (process_network(rev, &rev->net[k], in0 + i, in1 + i, wet0, wet1, n))
+            ran = true;
+        process_mix(rev->params, &batch->mix[c], in0 + i, in1 + i, wet0, wet1, out0 + i, out1 + i, n);
+    }
+    return ran;
+}
+
+/* run network `k` over a batch of the block's buffers */
+static void
+pair_process(PsxReverb *rev, uint32_t k, PsxBatch *batch)
+{
+    const bool mono = rev->variant->inputs == 1;
+
+    batch->ran[k] = pair_run(rev, k, batch, rev->in[mono ? 0 : 2 * k] + batch->offset,
+                             rev->in[mono ? 0 : 2 * k + 1] + batch->offset,
+                             rev->out[2 * k] + batch->offset, rev->out[2 * k + 1] + batch->offset);
+}
+
+#ifdef PSX_REV_THREADS
+/* times a thread polls for the next batch before it sleeps */
+#define PSX_REV_POOL_SPIN 4000
+
+/* the audio thread waits this fraction of a batch's length for networks threads are still running */
+#define PSX_REV_POOL_BUDGET 0.5
+
+typedef enum {
+    PSX_REV_SLOT_FREE,
+    PSX_REV_SLOT_QUEUED,    // up for grabs, see pool_claim()
+    PSX_REV_SLOT_RUNNING,
+    PSX_REV_SLOT_DONE,
+} PsxSlotState;
+
+/* a network's part of a batch, threads only work on these copies and never on the host's buffers */
+typedef struct {
+    uint32_t state;         // PsxSlotState
+    bool     late;          // the audio thread gave up on it, the result is dropped
+    bool     ran;
+    PsxBatch batch;
+    float    in[2][PSX_REV_BATCH * PSX_REV_CHUNK];
+    float    out[2][PSX_REV_BATCH * PSX_REV_CHUNK];
+} PsxPoolSlot;
+
+/**
+   Threads for the networks of one instance.  `run()` copies each network's
+   input of a batch into its slot and wakes the threads by bumping
+   `generation`, then the threads and the audio thread itself claim slots
+   until none are left.  The audio thread doesn't wait for threads that
+   haven't woken up yet, it runs their networks itself, so a late thread only
+   costs parallelism.  Networks threads have already claimed get a deadline:
+   if one isn't done by then, e.g. because its thread was preempted, its
+   channels are dry for the batch and its result is dropped.  Its network
+   sits out until the thread is done with it.  Preset switches in `run()` are
+   put off until then, see pool_late(), and anything else that changes the
+   networks waits for it, see pool_sync().  The threads take on the
+   audio thread's scheduling so other work doesn't preempt them in the
+   middle of a network.
+*/
+typedef struct PsxPool {
+    PsxReverb         *rev;
+    pthread_t          threads[PSX_REV_PAIRS_MAX - 1];
+    uint32_t           count;
+    uint32_t           generation;  // futex word
+    uint32_t           sleeping;    // threads waiting on the futex
+    bool               quit;
+    bool               sched;       // set once the audio thread's scheduling is known
+    int                policy;
+    struct sched_param param;
+    PsxPoolSlot        slots[PSX_REV_PAIRS_MAX];
+} PsxPool;
+
+static void
+pool_wait(uint32_t *word, uint32_t value)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void
+pool_wake(uint32_t *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+}
+
+static inline void
+pool_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static inline bool
+slot_take(PsxPoolSlot *slot)
+{
+    uint32_t queued = PSX_REV_SLOT_QUEUED;
+    return __atomic_compare_exchange_n(&slot->state, &queued, PSX_REV_SLOT_RUNNING, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/* run the queued networks of the current batch on a thread until all of them are claimed */
+static void
+pool_claim(PsxPool *pool)
+{
+    const bool mono = pool->rev->variant->inputs == 1;
+
+    for (uint32_t k = 0; k < pool->rev->variant->pairs; k++) {
+        PsxPoolSlot *slot = &pool->slots[k];
+
+        if (!slot_take(slot))
+            continue;
+        slot->ran = pair_run(pool->rev, k, &slot->batch, slot->in[0], slot->in[mono ? 0 : 1],
+                             slot->out[0], slot->out[1]);
+        __atomic_store_n(&slot->state, PSX_REV_SLOT_DONE, __ATOMIC_RELEASE);
+    }
+}
+
+static void *
+pool_thread(void *data)
+{
+    PsxPool *pool = (PsxPool *)data;
+    uint32_t seen = 0;
+    bool sched = false;
+
+    denormals_flush();
+    for (;;) {
+        uint32_t generation;
+        for (uint32_t i = 0; (generation = __atomic_load_n(&pool->generation, __ATOMIC_ACQUIRE)) == seen; i++) {
+            if (i < PSX_REV_POOL_SPIN) {
+                pool_relax();
+                continue;
+            }
+            __atomic_fetch_add(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+            pool_wait(&pool->generation, seen);
+            __atomic_fetch_sub(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+        }
+        seen = generation;
+
+        if (__atomic_load_n(&pool->quit, __ATOMIC_ACQUIRE))
+            return NULL;
+        if (!sched && __atomic_load_n(&pool->sched, __ATOMIC_ACQUIRE)) {
+            const int err = pthread_setschedparam(pthread_self(), pool->policy, &pool->param);
+            /* this thread isn't real-time then, so it may log */
+            if (err)
+                lv2_log_warning(&pool->rev->logger, "Could not give a thread the audio thread's priority (%s), "
+                                "its channels may drop out\n", strerror(err));
+            sched = true;
+        }
+        pool_claim(pool);
+    }
+}
+
+/* start a thread for every network but one, as far as there are CPUs for them, from the worker */
+static struct PsxPool *
+pool_open(PsxReverb *rev)
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t count = rev->variant->pairs - 1;
+
+    if (cpus > 0 && (unsigned long)cpus - 1 < count)
+        count = (uint32_t)(cpus - 1);
+    if (count == 0) {
+        lv2_log_error(&rev->logger, "Multithreading needs more than one CPU\n");
+        return NULL;
+    }
+
+    PsxPool *pool = (PsxPool *)calloc(1, sizeof(PsxPool));
+    if (!pool)
+        return NULL;
+    pool->rev = rev;
+    while (pool->count < count && pthread_create(&pool->threads[pool->count], NULL, pool_thread, pool) == 0)
+        pool->count++;
+    if (pool->count == 0) {
+        lv2_log_error(&rev->logger, "Could not start threads\n");
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+static void
+pool_close(struct PsxPool *pool)
+{
+    if (!pool)
+        return;
+
+    __atomic_store_n(&pool->quit, true, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&pool->generation, 1, __ATOMIC_SEQ_CST);
+    pool_wake(&pool->generation);
+    for (uint32_t i = 0; i < pool->count; i++)
+        pthread_join(pool->threads[i], NULL);
+    free(pool);
+}
+
+/* mix network `k` of a batch without its reverb */
+static void
+pair_dry(PsxReverb *rev, uint32_t k, PsxBatch *batch)
+{
+    const bool mono = rev->variant->inputs == 1;
+    const uint32_t len = batch->end - batch->offset;
+    const float zero[PSX_REV_CHUNK] = { 0.0f };
+    uint32_t c = 0;
+
+    for (uint32_t i = 0; i < len; i += PSX_REV_CHUNK, c++) {
+        const uint32_t n = (len - i < PSX_REV_CHUNK) ? len - i : PSX_REV_CHUNK;
+        const uint32_t offset = batch->offset + i;
+
+        process_mix(rev->params, &batch->mix[c], rev->in[mono ? 0 : 2 * k] + offset,
+                    rev->in[mono ? 0 : 2 * k + 1] + offset, zero, zero,
+                    rev->out[2 * k] + offset, rev->out[2 * k + 1] + offset, n);
+    }
+    batch->ran[k] = false;
+}
+
+/* free the slot of a late network once its thread is done, returns false if it still runs */
+static bool
+slot_collect(PsxReverb *rev, PsxPoolSlot *slot)
+{
+    if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != PSX_REV_SLOT_DONE)
+        return false;
+    if (slot->ran)
+        process_dirty(rev);
+    slot->late = false;
+    __atomic_store_n(&slot->state, PSX_REV_SLOT_FREE, __ATOMIC_RELAXED);
+    return true;
+}
+
+/* collect the late networks whose threads are done, returns true if any still runs */
+static bool
+pool_late(PsxReverb *rev)
+{
+    PsxPool *pool = rev->pool;
+    bool late = false;
+
+    if (!pool)
+        return false;
+    for (uint32_t k = 0; k < rev->variant->pairs; k++) {
+        if (pool->slots[k].late && !slot_collect(rev, &pool->slots[k]))
+            late = true;
+    }
+    return late;
+}
+
+/**
+   Wait for late networks, before anything outside of `run()` touches the
+   networks.  This may block until a preempted thread is scheduled again, so
+   `run()` checks pool_late() instead and tries again next block.
+*/
+static void
+pool_sync(PsxReverb *rev)
+{
+    while (pool_late(rev))
+        pool_relax();
+}
+
+/* run a batch on the pool, returns false if the audio thread has to run all networks alone */
+static bool
+pool_run(PsxReverb *rev, PsxBatch *batch)
+{
+    PsxPool *pool = rev->pool;
+    const uint32_t pairs = rev->variant->pairs;
+    const bool mono = rev->variant->inputs == 1;
+    const size_t len = batch->end - batch->offset;
+
+    if (!pool)
+        return false;
+    /*
+       The audio thread runs all networks now, late ones stay dry until their
+       threads are done.  While switching the networks are silent anyway, and
+       none may turn late before the switch resets them.
+    */
+    if (!rev->threads || rev->switching) {
+        if (!pool_late(rev))
+            return false;
+        for (uint32_t k = 0; k < pairs; k++) {
+            if (pool->slots[k].late)
+                pair_dry(rev, k, batch);
+            else
+                pair_process(rev, k, batch);
+        }
+        return true;
+    }
+
+    if (!pool->sched) {
+        if (pthread_getschedparam(pthread_self(), &pool->policy, &pool->param) != 0) {
+            pool->policy = SCHED_OTHER;
+            pool->param.sched_priority = 0;
+        }
+        __atomic_store_n(&pool->sched, true, __ATOMIC_RELEASE);
+    }
+
+    /* networks still late from an earlier batch sit this one out */
+    for (uint32_t k = 0; k < pairs; k++) {
+        PsxPoolSlot *slot = &pool->slots[k];
+
+        if (slot->late && !slot_collect(rev, slot))
+            continue;
+        slot->batch = *batch;
+        memcpy(slot->in[0], rev->in[mono ? 0 : 2 * k] + batch->offset, len * sizeof(float));
+        if (!mono)
+            memcpy(slot->in[1], rev->in[2 * k + 1] + batch->offset, len * sizeof(float));
+        __atomic_store_n(&slot->state, PSX_REV_SLOT_QUEUED, __ATOMIC_RELEASE);
+    }
+    __atomic_fetch_add(&pool->generation, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleeping, __ATOMIC_SEQ_CST))
+        pool_wake(&pool->generation);
+
+    /* the audio thread runs what is left on the block's buffers */
+    for (uint32_t k = 0; k < pairs; k++) {
+        if (slot_take(&pool->slots[k])) {
+            pair_process(rev, k, batch);
+            __atomic_store_n(&pool->slots[k].state, PSX_REV_SLOT_FREE, __ATOMIC_RELAXED);
+        }
+    }
+
+    const uint64_t budget = (uint64_t)(PSX_REV_POOL_BUDGET * 1e9 * (double)len / rev->rate);
+    const uint64_t deadline = stats_now() + budget;
+    for (uint32_t k = 0; k < pairs; k++) {
+        PsxPoolSlot *slot = &pool->slots[k];
+        uint32_t state;
+
+        if (slot->late) {
+            pair_dry(rev, k, batch);
+            continue;
+        }
+        /* offline there is no deadline, the output has to be the same as without threads */
+        for (uint32_t i = 1; (state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE)) == PSX_REV_SLOT_RUNNING; i++) {
+            if (!rev->freewheel && i % 64 == 0 && stats_now() > deadline)
+                break;
+            pool_relax();
+        }
+        if (state == PSX_REV_SLOT_DONE) {
+            memcpy(rev->out[2 * k] + batch->offset, slot->out[0], len * sizeof(float));
+            memcpy(rev->out[2 * k + 1] + batch->offset, slot->out[1], len * sizeof(float));
+            batch->ran[k] = slot->ran;
+            __atomic_store_n(&slot->state, PSX_REV_SLOT_FREE, __ATOMIC_RELAXED);
+        } else if (state == PSX_REV_SLOT_RUNNING) {
+            slot->late = true;
+            pair_dry(rev, k, batch);
+        }
+    }
+    return true;
+}
+#else
+static struct PsxPool *
+pool_open(PsxReverb *rev)
+{
+    lv2_log_error(&rev->logger, "Multithreading is not supported on this system\n");
+    return NULL;
+}
+
+static void
+pool_close(struct PsxPool *pool)
+{
+    (void)pool;
+}
+
+static bool
+pool_late(PsxReverb *rev)
+{
+    (void)rev;
+    return false;
+}
+
+static void
+pool_sync(PsxReverb *rev)
+{
+    (void)rev;
+}
+
+static bool
+pool_run(PsxReverb *rev, PsxBatch *batch)
+{
+    (void)rev;
+    (void)batch;
+    return false;
+}
+#endif
+
+/* records only go to the ring if the worker can log them */
+static bool
+stats_logging(const PsxReverb *rev)
+{
+#ifdef PSX_REV_ATOMICS
+    return rev->schedule && rev->logger.log;
+#else
+    (void)rev;
+    return false;
+#endif
+}
+
+/* a switch or the clearing after a crossfade is going on, the time of these counts as loading */
+static bool
+stats_loading(const PsxReverb *rev)
+{
+    return rev->switching || rev->pending || rev->fade_state == PSX_REV_FADE_CLEARING;
+}
+
+/* the stats read the clock a few times per block, they are skipped if nobody looks at them */
+static bool
+stats_enabled(const PsxReverb *rev)
+{
+    return rev->port_load || rev->port_load_peak || rev->port_reloads || rev->port_reload_time ||
+           rev->port_idle || stats_logging(rev);
+}
+
+/* hand the last window to the worker, dropped if it is behind */
+static void
+stats_push(PsxReverb *rev)
+{
+#ifdef PSX_REV_ATOMICS
+    PsxStats *st = &rev->stats;
+    const uint32_t head = st->head;
+    const PsxReverbWorkType work = PSX_REV_WORK_REPORT;
+
+    if (head - __atomic_load_n(&st->tail, __ATOMIC_ACQUIRE) >= PSX_REV_STATS_RING)
+        return;
+    st->ring[head % PSX_REV_STATS_RING] = st->last;
+    __atomic_store_n(&st->head, head + 1, __ATOMIC_RELEASE);
+    rev->schedule->schedule_work(rev->schedule->handle, sizeof(work), &work);
+#else
+    (void)rev;
+#endif
+}
+
+/* log the records run() left in the ring, from the worker */
+static void
+stats_report(PsxReverb *rev)
+{
+#ifdef PSX_REV_ATOMICS
+    PsxStats *st = &rev->stats;
+    const uint32_t head = __atomic_load_n(&st->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = st->tail;
+
+    for (; tail != head; tail++) {
+        const PsxStatsRecord *r = &st->ring[tail % PSX_REV_STATS_RING];
+        lv2_log_trace(&rev->logger, "%s: %.1f ns/sample, peak %.1f, %u presets loaded in %.2f ms%s\n",
+                      rev->variant->uri, r->load, r->load_peak, r->reloads, r->reload_time,
+                      r->idle ? ", idle" : "");
+    }
+    __atomic_store_n(&st->tail, tail, __ATOMIC_RELEASE);
+#else
+    (void)rev;
+#endif
+}
+
+/**
+   Account a block that started at `start` and write the output ports.  The
+   load is the time `run()` took per sample, averaged over about a second of
+   audio and at its worst in a single block of that second.
+*/
+static void
+stats_end(PsxReverb *rev, uint64_t start, uint32_t n_samples)
+{
+    PsxStats *st = &rev->stats;
+    const uint64_t ns = stats_now() - start;
+
+    st->window_ns += ns;
+    st->window_samples += n_samples;
+    if (n_samples > 0 && (float)ns / (float)n_samples > st->window_peak)
+        st->window_peak = (float)ns / (float)n_samples;
+
+    st->last.reload_time = (float)st->reload_ns * 1e-6f;
+    st->last.idle = true;
+    for (uint32_t k = 0; k < rev->variant->pairs; k++) {
+        if (rev->net[k].quiet < rev->tail)
+            st->last.idle = false;
+    }
+
+    if (st->window_samples >= (uint64_t)rev->rate) {
+        st->last.load = (float)st->window_ns / (float)st->window_samples;
+        st->last.load_peak = st->window_peak;
+        st->window_ns = 0;
+        st->window_samples = 0;
+        st->window_peak = 0.0f;
+        if (stats_logging(rev))
+            stats_push(rev);
+    }
+
+    if (rev->port_load)
+        *rev->port_load = st->last.load;
+    if (rev->port_load_peak)
+        *rev->port_load_peak = st->last.load_peak;
+    if (rev->port_reloads)
+        *rev->port_reloads = (float)st->last.reloads;
+    if (rev->port_reload_time)
+        *rev->port_reload_time = st->last.reload_time;
+    if (rev->port_idle)
+        *rev->port_idle = st->last.idle ? 1.0f : 0.0f;
+}
+
+/* have the worker start the threads the first time they are switched on */
+static void
+pool_request(PsxReverb *rev)
+{
+    const PsxReverbPoolWork work = { PSX_REV_WORK_POOL, NULL };
+
+    rev->pool_requested = true;
+    if (!rev->schedule) {
+        lv2_log_error(&rev->logger, "Multithreading needs the worker feature\n");
+        return;
+    }
+    if (rev->schedule->schedule_work(rev->schedule->handle, sizeof(work), &work) != LV2_WORKER_SUCCESS)
+        rev->pool_requested = false;
+}
+
+/* keep the latest custom preset request until the worker can take it */
+static void
+custom_request(PsxReverb *rev, const uint16_t *registers, const char *path, uint32_t path_size)
+{
+    PsxReverbCustomWork *work = &rev->custom_next;
+
+    if (!rev->schedule) {
+        lv2_log_error(&rev->logger, "Custom presets need the worker feature\n");
+        return;
+    }
+
+    work->type = PSX_REV_WORK_CUSTOM;
+    work->ok = false;
+    if (registers)
+        memcpy(work->registers, registers, sizeof(work->registers));
+    memcpy(work->path, path, path_size);
+    work->path[path_size] = '\0';
+    rev->custom_next_size = (uint32_t)(offsetof(PsxReverbCustomWork, path) + path_size + 1);
+    rev->custom_queued = true;
+}
+
+/* numeric parameter value, hosts send floats but integers are fine too */
+static bool
+control_number(const PsxReverb *rev, const LV2_Atom *value, float *number)
+{
+    if (value->type == rev->uris.atom_Float && value->size == sizeof(float)) {
+        *number = ((const LV2_Atom_Float *)value)->body;
+        return true;
+    }
+    if (value->type == rev->uris.atom_Int && value->size == sizeof(int32_t)) {
+        *number = (float)((const LV2_Atom_Int *)value)->body;
+        return true;
+    }
+    return false;
+}
+
+/**
+   Handle a `patch:Set` message from the control port.  Wet, dry, master and
+   the preset work like their ports and hold until the port changes.  The
+   custom registers are either an `atom:Vector` of 32 `atom:Int` or a 64 byte
+   `atom:Chunk` in register order, a register file is an `atom:Path`.  Only the
+   shape of these is checked here, everything else is left to the worker.
+*/
+static void
+control_event(PsxReverb *rev, const LV2_Atom_Event *ev)
+{
+    const LV2_Atom_Object *obj = (const LV2_Atom_Object *)&ev->body;
+    if ((obj->atom.type != rev->uris.atom_Object && obj->atom.type != rev->uris.atom_Blank) ||
+        obj->body.otype != rev->uris.patch_Set)
+        return;
+
+    const LV2_Atom *property = NULL;
+    const LV2_Atom *value = NULL;
+    lv2_atom_object_get(obj, rev->uris.patch_property, &property, rev->uris.patch_value, &value, 0);
+    if (!property || property->type != rev->uris.atom_URID || !value)
+        return;
+
+    const LV2_URID key = ((const LV2_Atom_URID *)property)->body;
+    float number;
+    if (key == rev->uris.wet && control_number(rev, value, &number)) {
+        gain_set(&rev->wet, rev->gain_db, number);
+    } else if (key == rev->uris.dry && control_number(rev, value, &number)) {
+        gain_set(&rev->dry, rev->gain_db, number);
+    } else if (key == rev->uris.master && control_number(rev, value, &number)) {
+        gain_set(&rev->master, rev->gain_db, number);
+    } else if (key == rev->uris.preset && control_number(rev, value, &number)) {
+        preset_index(rev, (int)number);
+    } else if (key == rev->uris.registers && value->type == rev->uris.atom_Vector) {
+        const LV2_Atom_Vector *vec = (const LV2_Atom_Vector *)value;
+        const int32_t *v = (const int32_t *)(vec + 1);
+        uint16_t registers[0x20];
+
+        if (vec->body.child_type != rev->uris.atom_Int || vec->body.child_size != sizeof(int32_t) ||
+            vec->atom.size != sizeof(vec->body) + sizeof(int32_t) * 0x20) {
+            lv2_log_error(&rev->logger, "Custom registers need 32 values\n");
+            return;
+        }
+        for (int i = 0; i < 0x20; i++)
+            registers[i] = (uint16_t)v[i];
+        custom_request(rev, registers, "", 0);
+    } else if (key == rev->uris.registers && value->type == rev->uris.atom_Chunk) {
+        if (value->size != 0x20 * sizeof(uint16_t)) {
+            lv2_log_error(&rev->logger, "Custom registers need 32 values\n");
+            return;
+        }
+        custom_request(rev, (const uint16_t *)LV2_ATOM_BODY(value), "", 0);
+    } else if (key == rev->uris.registerFile && value->type == rev->uris.atom_Path) {
+        const char *path = (const char *)LV2_ATOM_BODY(value);
+        const uint32_t len = (uint32_t)strnlen(path, value->size);
+        if (len == 0 || len >= PSX_REV_PATH_MAX) {
+            lv2_log_error(&rev->logger, "Invalid register file path\n");
+            return;
+        }
+        custom_request(rev, NULL, path, len);
+    }
+}
+
+/**
+   Handle the control port events up to frame `until` and return the frame
+   of the next one, `run()` splits the block there.  `next` is NULL without a
+   control port.
+*/
+static int64_t
+control_events(PsxReverb *rev, const LV2_Atom_Event **next, int64_t until)
+{
+    const LV2_Atom_Sequence *seq = rev->port_control;
+
+    if (!*next)
+        return INT64_MAX;
+    for (; !lv2_atom_sequence_is_end(&seq->body, seq->atom.size, *next); *next = lv2_atom_sequence_next(*next)) {
+        if ((*next)->time.frames > until)
+            return (*next)->time.frames;
+        control_event(rev, *next);
+    }
+    return INT64_MAX;
+}
+
+/**
+   Pass the queued custom preset to the worker.  It converts into the set the
+   custom preset doesn't use, and only if no switch is on the way, so neither
+   the parameters in use, those a switch goes to nor those being faded out
+   are written.
+*/
+static void
+custom_schedule(PsxReverb *rev)
+{
+    const uint32_t slot = rev->custom_slot ^ 1;
+
+    if (rev->custom_busy || rev->switching ||
+        (rev->params >= rev->custom[slot] && rev->params < rev->custom[slot] + NUM_RATES) ||
+        (rev->fade->params >= rev->custom[slot] && rev->fade->params < rev->custom[slot] + NUM_RATES))
+        return;
+
+    rev->custom_next.slot = slot;
+    rev->custom_queued = false;
+    if (rev->schedule->schedule_work(rev->schedule->handle, rev->custom_next_size, &rev->custom_next) ==
+        LV2_WORKER_SUCCESS)
+        rev->custom_busy = true;
+    else
+        lv2_log_error(&rev->logger, "Could not schedule custom preset\n");
+}
+
+/* switch preset, network rate or engine if they changed, see preset_switch() and fade_start() */
+static void
+preset_update(PsxReverb *rev)
+{
+    const int request = preset_index(rev, rev->preset_request);
+    const int preset = rev->custom_selected ? PSX_REV_PRESET_CUSTOM : request;
+    PsxReverbEngine engine = rev->engine_request;
+
+    /* bounces get the full quality, the eco engine is for monitoring */
+    if (engine == PSX_REV_ENGINE_ECO && rev->freewheel)
+        engine = PSX_REV_ENGINE_SHARED;
+
+    const bool native = engine != PSX_REV_ENGINE_ECO && rev->native_request && rev->net[0].resampler.factor > 1;
+    const bool custom = preset == PSX_REV_PRESET_CUSTOM && rev->params != preset_params(rev, native, engine, preset);
+
+    if (rev->switching || rev->fade_state == PSX_REV_FADE_RUNNING ||
+        (preset == rev->preset && native == rev->native && engine == rev->engine && !custom))
+        return;
+
+    /* crossfade if the crossfade networks fit the preset, waiting for them to be cleared */
+    const size_t used = engine_buffer_used(rev, preset_params(rev, native, engine, preset), engine);
+    const uint32_t len = fade_length(rev);
+    if (len && rev->fade_state == PSX_REV_FADE_IDLE && used <= rev->fade->spu_buffer_count) {
+        if (switch_begin(rev))
+            fade_start(rev, preset, native, engine, len);
+    } else if (!len || rev->fade_state == PSX_REV_FADE_IDLE || used > rev->fade_count) {
+        if (switch_begin(rev))
+            preset_switch(rev, preset, native, engine);
+    }
+}
+
+/* apply control changes before a span, the buffer is cleared at most a step per block */
+static void
+process_controls(PsxReverb *rev, bool block_start)
+{
+    preset_update(rev);
+    if (block_start && rev->pending)
+        preset_clear_step(rev);
+    if (block_start && rev->fade_state == PSX_REV_FADE_CLEARING)
+        fade_clear_step(rev);
+}
+
+/**
+   Run the networks and mix samples `offset` to `end` of the block.  During a
+   crossfade, all networks go through the block chunk by chunk, see
+   fade_network().  Otherwise each network runs over a batch of chunks at a
+   time, on the pool if it is switched on.  Both give the same output.
+*/
+static void
+process_span(PsxReverb *rev, uint32_t offset, uint32_t end)
+{
+    const bool mono = rev->variant->inputs == 1;
+
+    for (; offset < end && rev->fade_state == PSX_REV_FADE_RUNNING; offset += PSX_REV_CHUNK) {
+        const uint32_t n = (end - offset < PSX_REV_CHUNK) ? end - offset : PSX_REV_CHUNK;
+        float wet0[PSX_REV_CHUNK];
+        float wet1[PSX_REV_CHUNK];
+        PsxMix mix;
+
+        mix_prepare(rev, &mix, n);
+        for (uint32_t k = 0; k < rev->variant->pairs; k++) {
+            const float *in0 = rev->in[mono ? 0 : 2 * k] + offset;
+            const float *in1 = rev->in[mono ? 0 : 2 * k + 1] + offset;
+            float *out0 = rev->out[2 * k] + offset;
+            float *out1 = rev->out[2 * k + 1] + offset;
+
+            if (process_network(rev, &rev->net[k], in0, in1, wet0, wet1, n))
+                process_dirty(rev);
+            fade_network(rev, k, in0, in1, wet0, wet1, n);
+            process_mix(rev->params, &mix, in0, in1, wet0, wet1, out0, out1, n);
+        }
+
+        rev->fade_pos += n;
+        if (rev->fade_pos >= rev->fade_len)
+            fade_end(rev);
+    }
+
+    while (offset < end) {
+        PsxBatch batch;
+
+        batch_prepare(rev, &batch, offset, end);
+        if (!pool_run(rev, &batch)) {
+            for (uint32_t k = 0; k < rev->variant->pairs; k++)
+                pair_process(rev, k, &batch);
+        }
+        for (uint32_t k = 0; k < rev->variant->pairs; k++) {
+            if (batch.ran[k])
+                process_dirty(rev);
+        }
+        offset = batch.end;
+    }
+}
+
+/**
+   The `run()` method is the main process function of the plugin.  It processes
+   a block of audio in the audio context.  Since this plugin is
+   `lv2:hardRTCapable`, `run()` must be real-time safe, so blocking (e.g. with
+   a mutex) or memory allocation are not allowed.
+
+   The block is processed in chunks: first the reverb network writes the wet
+   signal of a chunk to a scratch buffer, then wet and dry signal are mixed.
+   This keeps in-place processing working and lets the mix loop vectorize.
+   Variants with more channels run one network per output pair, all with
+   the same controls.  Networks with silent input and tail are skipped, see
+   network_idle().
+
+   Control ports are read once per block, events on the control port take
+   effect at their frame.  The block is split there, so automation stays
+   sample accurate with large blocks.
+*/
+static void
+run(LV2_Handle instance, uint32_t n_samples)
+{
+    PsxReverb* rev = (PsxReverb*)instance;
+    const bool stats = stats_enabled(rev);
+    const uint64_t start = stats ? stats_now() : 0;
+    const uint64_t fp_state = denormals_flush();
+    const LV2_Atom_Event *ev = rev->port_control ? lv2_atom_sequence_begin(&rev->port_control->body) : NULL;
+
+    if (*rev->port_preset != rev->preset_port) {
+        rev->preset_port = *rev->port_preset;
+        preset_index(rev, (int)rev->preset_port);
+    }
+    gain_port(&rev->wet, rev->gain_db, *rev->port_wet);
+    gain_port(&rev->dry, rev->gain_db, *rev->port_dry);
+    gain_port(&rev->master, rev->gain_db, *rev->port_master);
+    rev->engine_request = engine_index(*rev->port_engine);
+    rev->native_request = *rev->port_native > 0.5f;
+    rev->freewheel = rev->port_freewheel && *rev->port_freewheel > 0.5f;
+    rev->threads = rev->port_threads && *rev->port_threads > 0.5f;
+    rev->crossfade = *rev->port_crossfade;
+
+    uint32_t offset = 0;
+    do {
+        const int64_t next = control_events(rev, &ev, offset);
+        const uint32_t end = next < n_samples ? (uint32_t)next : n_samples;
+        const uint64_t load = stats ? stats_now() : 0;
+        const PsxReverbParams *params = rev->params;
+        const bool busy = stats_loading(rev);
+
+        process_controls(rev, offset == 0);
+        if (stats && (busy || params != rev->params || stats_loading(rev)))
+            rev->stats.reload_ns += stats_now() - load;
+
+        process_span(rev, offset, end);
+        offset = end;
+    } while (offset < n_samples);
+    control_events(rev, &ev, INT64_MAX);
+
+    /* custom presets are converted by the worker and selected once it is done */
+    if (rev->custom_queued)
+        custom_schedule(rev);
+    if (!rev->pool_requested && rev->threads)
+        pool_request(rev);
+
+    /* the FPU flushes denormals in here if it can, see denormals_flush() */
+    if (rev->port_denormals) {
+#if defined(PSX_REV_FTZ_SSE) || defined(PSX_REV_FTZ_AARCH64)
+        *rev->port_denormals = 1.0f;
+#else
+        *rev->port_denormals = 0.0f;
+#endif
+    }
+
+    denormals_restore(fp_state);
+    if (stats)
+        stats_end(rev, start, n_samples);
+}
+
+/**
+   The `deactivate()` method is the counterpart to `activate()`, and is called by
+   the host after running the plugin.  It indicates that the host will not call
+   `run()` again until another call to `activate()` and is mainly useful for more
+   advanced plugins with ``live'' characteristics such as those with auxiliary
+   processing threads.  This plugin only forgets that a state was restored:
+   `activate()` keeps a state restored while the plugin is inactive, but one
+   restored before the last activation is stale by the next one.
+
+   This method is in the ``instantiation'' threading class, so no other
+   methods on this instance will be called concurrently with it.
+*/
+static void
+deactivate(LV2_Handle instance)
+{
+    PsxReverb* rev = (PsxReverb*)instance;
+    rev->restored = false;
+}
+
+/**
+   Destroy a plugin instance (counterpart to `instantiate()`).
+
+   This method is in the ``instantiation'' threading class, so no other
+   methods on this instance will be called concurrently with it.
+*/
+static void
+cleanup(LV2_Handle instance)
+{
+    PsxReverb* rev = (PsxReverb*)instance;
+
+    pool_close(rev->pool);
+    instance_close(rev);
+}
+
+/**
+   Read the registers from a file, either a 64 byte dump of the SPU reverb
+   registers (little endian, in register order) or text with 32 hexadecimal
+   values.  In text, values are separated by whitespace or commas, and `#`
+   line comments as well as C comments are skipped, so a preset copied from
+   the table at the bottom of this file can be used as is.
+*/
+static bool
+custom_read(PsxReverb *rev, const char *path, uint16_t *registers)
+{
+    char text[4096];
+    FILE *f = fopen(path, "rb");
+
+    if (!f) {
+        lv2_log_error(&rev->logger, "Could not open register file %s\n", path);
+        return false;
+    }
+    const size_t len = fread(text, 1, sizeof(text) - 1, f);
+    const bool complete = feof(f);
+    fclose(f);
+    if (!complete) {
+        lv2_log_error(&rev->logger, "Register file %s is too long\n", path);
+        return false;
+    }
+
+    if (len == 0x20 * sizeof(uint16_t)) {
+        for (int i = 0; i < 0x20; i++)
+            registers[i] = (uint16_t)((uint8_t)text[2 * i] | (uint8_t)text[2 * i + 1] << 8);
+        return true;
+    }
+
+    text[len] = '\0';
+    int count = 0;
+    for (const char *c = text; *c; ) {
+        if (*c == '#') {
+            c += strcspn(c, "\n");
+        } else if (c[0] == '/' && c[1] == '*') {
+            const char *end = strstr(c + 2, "*/");
+            c = end ? end + 2 : c + strlen(c);
+        } else if (strchr(" \t\r\n,{}", *c)) {
+            c++;
+        } else {
+            char *end;
+            const unsigned long v = strtoul(c, &end, 16);
+            if (end == c || v > 0xFFFF || count == 0x20)
+                break;
+            registers[count++] = (uint16_t)v;
+            c = end;
+            if (*c && !strchr(" \t\r\n,{}#/", *c))
+                break;
+        }
+    }
+    if (count != 0x20) {
+        lv2_log_error(&rev->logger, "Register file %s needs 32 hexadecimal values\n", path);
+        return false;
+    }
+    return true;
+}
+
+/**
+   Convert custom registers in both parameter sets of `slot`.  The registers
+   are rejected if they reach beyond the SPU RAM, and without a worker sizing
+   the buffer, if an engine would need more than the buffer has.
+*/
+static bool
+custom_convert(PsxReverb *rev, uint32_t slot, const uint16_t *registers)
+{
+    const PsxReverbPreset *preset = (const PsxReverbPreset *)registers;
+    const uint32_t size = preset_size(preset);
+
+    if (size > SPU_REV_MEM_MAX) {
+        lv2_log_error(&rev->logger, "Custom registers need 0x%X bytes of SPU RAM\n", size);
+        return false;
+    }
+
+    for (unsigned row = 0; row < NUM_RATES; row++) {
+        PsxReverbParams *params = &rev->custom[slot][row];
+
+        preset_convert_registers(params, preset, size, network_rate(rev, row));
+        if (row == PSX_REV_RATE_ECO)
+            eco_reduce(params);
+        if (!rev->spu_buffer_resize &&
+            (params->buffer_count > rev->spu_buffer_count_mask + 1 || params->lines.count > rev->spu_buffer_count)) {
+            lv2_log_error(&rev->logger, "Custom registers don't fit the SPU buffer\n");
+            return false;
+        }
+    }
+    memcpy(rev->custom_registers[slot], registers, sizeof(rev->custom_registers[slot]));
+    return true;
+}
+
+/* read and convert custom registers for work(), the path isn't sent back */
+static LV2_Worker_Status
+work_custom(PsxReverb                  *rev,
+            LV2_Worker_Respond_Function respond,
+            LV2_Worker_Respond_Handle   handle,
+            uint32_t                    size,
+            const void*                 data)
+{
+    const size_t head = offsetof(PsxReverbCustomWork, path);
+    PsxReverbCustomWork work;
+
+    if (size <= head || size > sizeof(work))
+        return LV2_WORKER_ERR_UNKNOWN;
+    memcpy(&work, data, size);
+    work.path[size - head - 1] = '\0';
+
+    work.ok = (!work.path[0] || custom_read(rev, work.path, work.registers)) &&
+              custom_convert(rev, work.slot, work.registers);
+    return respond(handle, (uint32_t)head, &work);
+}
+
+/**
+   The worker prepares the SPU buffer for preset switches outside of the audio
+   thread.  If the buffer is sized per preset, it allocates a cleared buffer of
+   the size the new preset needs and frees the old one, otherwise it clears the
+   existing buffer.  `run()` doesn't touch the buffer until `work_response()`
+   swapped in the new one, so this doesn't race with processing.  Custom
+   presets are converted here as well, see `custom_schedule()`, and the buffer
+   of the crossfade networks is cleared after a crossfade, see `fade_end()`.
+*/
+static LV2_Worker_Status
+work(LV2_Handle                  instance,
+     LV2_Worker_Respond_Function respond,
+     LV2_Worker_Respond_Handle   handle,
+     uint32_t                    size,
+     const void*                 data)
+{
+    PsxReverb* rev = (PsxReverb*)instance;
+    PsxReverbWorkType type;
+    PsxReverbWork work;
+
+    if (size < sizeof(type))
+        return LV2_WORKER_ERR_UNKNOWN;
+    memcpy(&type, data, sizeof(type));
+    if (type == PSX_REV_WORK_CUSTOM)
+        return work_custom(rev, respond, handle, size, data);
+    if (type == PSX_REV_WORK_REPORT) {
+        stats_report(rev);
+        return LV2_WORKER_SUCCESS;
+    }
+    if (type == PSX_REV_WORK_POOL) {
+        const PsxReverbPoolWork pool = { PSX_REV_WORK_POOL, pool_open(rev) };
+        const LV2_Worker_Status status = respond(handle, sizeof(pool), &pool);
+        if (status != LV2_WORKER_SUCCESS)
+            pool_close(pool.pool);
+        return status;
+    }
+
+    if (size != sizeof(work))
+        return LV2_WORKER_ERR_UNKNOWN;
+    memcpy(&work, data, sizeof(work));
+    if (type == PSX_REV_WORK_FADE) {
+        fade_buffer_prepare(rev, &work.buffer, &work.buffer_count, &work.buffer_dirty);
+        return respond(handle, sizeof(work), &work);
+    }
+
+    const size_t count = engine_buffer_count(work.params, work.engine, work.params->buffer_count);
+    float *buffer = NULL;
+    if (rev->spu_buffer_resize && count != work.buffer_count)
+        buffer = calloc(count * rev->variant->pairs, sizeof(float));
+
+    if (buffer) {
+        free(work.buffer);
+        work.buffer = buffer;
+        work.buffer_count = count;
+        work.buffer_dirty = 0;
+    } else {
+        size_t used = engine_buffer_used(rev, work.params, work.engine);
+        if (work.buffer_count < count) {
+            /* keep the old preset and engine on the cleared buffer */
+            lv2_log_error(&rev->logger, "Could not allocate SPU buffer\n");
+            work.params = rev->params;
+            work.engine = rev->kernel;
+            used = rev->spu_buffer_used;
+        }
+        work.buffer_dirty = buffer_clear(work.buffer, work.buffer_count, rev->variant->pairs,
+                                         work.buffer_dirty, used);
+    }
+
+    return respond(handle, sizeof(work), &work);
+}
+
+static LV2_Worker_Status
+work_response(LV2_Handle  instance,
+              uint32_t    size,
+              const void* data)
+{
+    PsxReverb* rev = (PsxReverb*)instance;
+    const PsxReverbWork* work = (const PsxReverbWork*)data;
+    PsxReverbWorkType type;
+
+    if (size < sizeof(type))
+        return LV2_WORKER_ERR_UNKNOWN;
+    memcpy(&type, data, sizeof(type));
+    if (type == PSX_REV_WORK_CUSTOM) {
+        PsxReverbCustomWork custom;
+
+        if (size < offsetof(PsxReverbCustomWork, path))
+            return LV2_WORKER_ERR_UNKNOWN;
+        memcpy(&custom, data, offsetof(PsxReverbCustomWork, path));
+        rev->custom_busy = false;
+        /* run() switches to the new set */
+        if (custom.ok) {
+            rev->custom_slot = custom.slot;
+            rev->custom_selected = true;
+        }
+        return LV2_WORKER_SUCCESS;
+    }
+    if (type == PSX_REV_WORK_POOL) {
+        PsxReverbPoolWork pool;
+
+        if (size != sizeof(pool))
+            return LV2_WORKER_ERR_UNKNOWN;
+        memcpy(&pool, data, sizeof(pool));
+        rev->pool = pool.pool;
+        return LV2_WORKER_SUCCESS;
+    }
+    if (type == PSX_REV_WORK_FADE) {
+        rev->fade->spu_buffer = work->buffer;
+        rev->fade->spu_buffer_count = work->buffer_count;
+        rev->fade->spu_buffer_dirty = work->buffer_dirty;
+        rev->fade_state = PSX_REV_FADE_IDLE;
+        return LV2_WORKER_SUCCESS;
+    }
+
+    preset_switch_done(rev, work->params, work->engine, work->buffer, work->buffer_count, work->buffer_dirty);
+    return LV2_WORKER_SUCCESS;
+}
+
+/* snapshot of the reverb tail, the header is followed by each network's state and buffer */
+#define PSX_REV_STATE_VERSION 1
+
+typedef struct {
+    uint32_t version;
+    uint32_t rate;          // bits of the samplerate
+    uint32_t pairs;
+    int32_t  preset;
+    uint32_t native;
+    uint32_t engine;
+    uint64_t buffer_used;   // floats per network
+} PsxStateTail;
+
+typedef struct {
+    uint32_t BufferAddress;
+    uint32_t lines_time;
+    uint32_t quiet;
+    uint32_t phase_in;
+    uint32_t phase_out;
+    uint32_t pos_in;
+    uint32_t pos_out;
+    float    hist_in[2][2 * RESAMPLER_LEN_MAX];
+    float    hist_out[2][2 * RESAMPLER_TAPS];
+} PsxStateNetwork;
+
+/* engine in the tail, interleaved lines keep a different layout in the buffer */
+static uint32_t
+state_tail_engine(const PsxReverb *rev)
+{
+    if (rev->kernel == PSX_REV_ENGINE_LINES)
+        return rev->kernel | (PSX_REV_LINES_STRIDE - 1) << 8;
+    return rev->kernel;
+}
+
+static size_t
+state_tail_size(const PsxReverb *rev)
+{
+    return sizeof(PsxStateTail) + rev->variant->pairs *
+           (sizeof(PsxStateNetwork) + rev->spu_buffer_used * sizeof(rev->spu_buffer[0]));
+}
+
+/* custom registers in the state, as an atom:Vector of atom:Int */
+typedef struct {
+    LV2_Atom_Vector_Body body;
+    int32_t              registers[0x20];
+} PsxStateRegisters;
+
+/**
+   Save the preset, network rate and engine in use and the smoothed gains.
+   A custom preset saves its registers along with the preset port value it
+   was selected at.  Unless it is clear, the part of the buffer the engine uses is saved as
+   well, so the tail goes on where it was after restoring.  The host may call
+   this while `run()` is processing, so the tail may be a few samples apart
+   from the other state; it is left out while switching presets.
+*/
+static LV2_State_Status
+state_save(LV2_Handle                instance,
+           LV2_State_Store_Function  store,
+           LV2_State_Handle          handle,
+           uint32_t                  flags,
+           const LV2_Feature* const* features)
+{
+    PsxReverb* rev = (PsxReverb*)instance;
+    const uint32_t pod = LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE;
+
+    const bool custom = rev->preset == PSX_REV_PRESET_CUSTOM;
+    const int32_t preset = custom ? rev->preset_request : rev->preset;
+    const int32_t native = rev->native;
+    const int32_t engine = rev->engine;
+    const float wet = rev->wet.value;
+    const float dry = rev->dry.value;
+    const float master = rev->master.value;
+    store(handle, rev->uris.preset, &preset, sizeof(preset), rev->uris.atom_Int, pod);
+    store(handle, rev->uris.native, &native, sizeof(native), rev->uris.atom_Bool, pod);
+    store(handle, rev->uris.engine, &engine, sizeof(engine), rev->uris.atom_Int, pod);
+    store(handle, rev->uris.wet, &wet, sizeof(wet), rev->uris.atom_Float, pod);
+    store(handle, rev->uris.dry, &dry, sizeof(dry), rev->uris.atom_Float, pod);
+    store(handle, rev->uris.master, &master, sizeof(master), rev->uris.atom_Float, pod);
+    if (custom) {
+        PsxStateRegisters registers = { { sizeof(int32_t), rev->uris.atom_Int }, { 0 } };
+        for (int i = 0; i < 0x20; i++)
+            registers.registers[i] = rev->custom_registers[rev->custom_slot][i];
+        store(handle, rev->uris.registers, &registers, sizeof(registers), rev->uris.atom_Vector, pod);
+    }
+
+#ifdef PSX_REV_ATOMICS
+    __atomic_store_n(&rev->saving, true, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&rev->switching, __ATOMIC_SEQ_CST) && rev->spu_buffer_dirty > 0 &&
+        rev->params == preset_params(rev, rev->native, rev->engine, rev->preset)) {
+        const size_t size = state_tail_size(rev);
+        PsxStateTail *tail = malloc(size);
+
+        if (tail) {
+            tail->version = PSX_REV_STATE_VERSION;
+            memcpy(&tail->rate, &rev->rate, sizeof(tail->rate));
+            tail->pairs = rev->variant->pairs;
+            tail->preset = rev->preset;
+            tail->native = rev->native;
+            tail->engine = state_tail_engine(rev);
+            tail->buffer_used = rev->spu_buffer_used;
+
+            uint8_t *pos = (uint8_t *)(tail + 1);
+            for (uint32_t k = 0; k < rev->variant->pairs; k++) {
+                const PsxReverbNetwork *net = &rev->net[k];
+                PsxStateNetwork state;
+
+                state.BufferAddress = net->BufferAddress;
+                state.lines_time = net->lines_time;
+                state.quiet = net->quiet;
+                state.phase_in = net->resampler.phase_in;
+                state.phase_out = net->resampler.phase_out;
+                state.pos_in = net->resampler.pos_in;
+                state.pos_out = net->resampler.pos_out;
+                memcpy(state.hist_in, net->resampler.hist_in, sizeof(state.hist_in));
+                memcpy(state.hist_out, net->resampler.hist_out, sizeof(state.hist_out));
+                memcpy(pos, &state, sizeof(state));
+                pos += sizeof(state);
+                memcpy(pos, net->buffer, rev->spu_buffer_used * sizeof(net->buffer[0]));
+                pos += rev->spu_buffer_used * sizeof(net->buffer[0]);
+            }
+            store(handle, rev->uris.tail, tail, size, rev->uris.Tail, LV2_STATE_IS_POD);
+            free(tail);
+        }
+    }
+    __atomic_store_n(&rev->saving, false, __ATOMIC_SEQ_CST);
+#endif
+
+    return LV2_STATE_SUCCESS;
+}
+
+/* get a property of the given type and size, NULL if it is missing or doesn't match */
+static const void *
+state_value(LV2_State_Retrieve_Function retrieve, LV2_State_Handle handle,
+            LV2_URID key, LV2_URID type, size_t size)
+{
+    size_t value_size;
+    uint32_t value_type;
+    uint32_t value_flags;
+    const void *value = retrieve(handle, key, &value_size, &value_type, &value_flags);
+
+    return (value && value_type == type && value_size == size) ? value : NULL;
+}
+
+static void
+state_gain(PsxGain *g, const float *value)
+{
+    if (value) {
+        g->value = *value;
+        g->target = *value;
+        /* the next gain_port() picks up the port and ramps from here */
+        g->db = NAN;
+        g->port = NAN;
+    }
+}
+
+/**
+   Restore the state saved by `state_save()`.  The tail is only restored if
+   it was saved with the same samplerate, variant and buffer layout, else the
+   reverb starts from silence.  Custom registers are converted right here,
+   if they are invalid the preset port's preset is used.  If this is called
+   before `activate()`, the restored state is kept by it.
+*/
+static LV2_State_Status
+state_restore(LV2_Handle                  instance,
+              LV2_State_Retrieve_Function retrieve,
+              LV2_State_Handle            handle,
+              uint32_t                    flags,
+              const LV2_Feature* const*   features)
+{
+    PsxReverb* rev = (PsxReverb*)instance;
+
+    pool_sync(rev);
+    state_gain(&rev->wet, state_value(retrieve, handle, rev->uris.wet, rev->uris.atom_Float, sizeof(float)));
+    state_gain(&rev->dry, state_value(retrieve, handle, rev->uris.dry, rev->uris.atom_Float, sizeof(float)));
+    state_gain(&rev->master, state_value(retrieve, handle, rev->uris.master, rev->uris.atom_Float, sizeof(float)));
+
+    /* the worker still owns the buffer if it is preparing a switch */
+    if (rev->switching && !rev->pending) {
+        rev->restored = true;
+        return LV2_STATE_SUCCESS;
+    }
+
+    const int32_t *preset = state_value(retrieve, handle, rev->uris.preset, rev->uris.atom_Int, sizeof(int32_t));
+    const int32_t *native = state_value(retrieve, handle, rev->uris.native, rev->uris.atom_Bool, sizeof(int32_t));
+    const int32_t *engine = state_value(retrieve, handle, rev->uris.engine, rev->uris.atom_Int, sizeof(int32_t));
+    const PsxStateRegisters *registers = state_value(retrieve, handle, rev->uris.registers, rev->uris.atom_Vector,
+                                                     sizeof(PsxStateRegisters));
+
+    rev->preset_request = preset ? *preset : rev->preset_request;
+    rev->preset_port = NAN;
+    rev->engine = engine ? engine_index((float)*engine) : rev->engine;
+    rev->native = native ? *native && rev->net[0].resampler.factor > 1 : rev->native;
+    if (rev->engine == PSX_REV_ENGINE_ECO)
+        rev->native = false;
+    rev->switching = false;
+    rev->pending = NULL;
+
+    fade_reset(rev);
+
+    /* the worker may still convert into the other set, this one is free */
+    rev->custom_queued = false;
+    rev->custom_selected = false;
+    if (registers && registers->body.child_type == rev->uris.atom_Int &&
+        registers->body.child_size == sizeof(int32_t)) {
+        uint16_t custom[0x20];
+        for (int i = 0; i < 0x20; i++)
+            custom[i] = (uint16_t)registers->registers[i];
+        rev->custom_selected = custom_convert(rev, rev->custom_slot, custom);
+    }
+    preset_load(rev, rev->custom_selected ? PSX_REV_PRESET_CUSTOM : preset_index(rev, rev->preset_request));
+    networks_reset(rev);
+    rev->restored = true;
+
+    size_t size;
+    uint32_t type;
+    uint32_t value_flags;
+    const PsxStateTail *tail = retrieve(handle, rev->uris.tail, &size, &type, &value_flags);
+    uint32_t rate;
+    memcpy(&rate, &rev->rate, sizeof(rate));
+
+    if (!tail || type != rev->uris.Tail || size < sizeof(PsxStateTail) ||
+        tail->version != PSX_REV_STATE_VERSION || tail->rate != rate ||
+        tail->pairs != rev->variant->pairs || tail->preset != rev->preset ||
+        tail->native != rev->native || tail->engine != state_tail_engine(rev) ||
+        tail->buffer_used != rev->spu_buffer_used || size != state_tail_size(rev))
+        return LV2_STATE_SUCCESS;
+
+    const uint8_t *pos = (const uint8_t *)(tail + 1);
+    for (uint32_t k = 0; k < rev->variant->pairs; k++) {
+        PsxReverbNetwork *net = &rev->net[k];
+        PsxStateNetwork state;
+
+        memcpy(&state, pos, sizeof(state));
+        pos += sizeof(state);
+        net->BufferAddress = state.BufferAddress;
+        net->lines_time = state.lines_time;
+        net->quiet = state.quiet;
+        net->resampler.phase_in = state.phase_in;
+        net->resampler.phase_out = state.phase_out;
+        net->resampler.pos_in = state.pos_in;
+        net->resampler.pos_out = state.pos_out;
+        memcpy(net->resampler.hist_in, state.hist_in, sizeof(state.hist_in));
+        memcpy(net->resampler.hist_out, state.hist_out, sizeof(state.hist_out));
+        memcpy(net->buffer, pos, rev->spu_buffer_used * sizeof(net->buffer[0]));
+        pos += rev->spu_buffer_used * sizeof(net->buffer[0]);
+    }
+    rev->spu_buffer_dirty = rev->spu_buffer_used;
+
+    return LV2_STATE_SUCCESS;
+}
+
+/* swap the preset table for one at the instance's new rate, the old one is kept if that fails */
+static bool
+table_reopen(PsxReverb *rev)
+{
+    const PsxReverbParams (*table)[NUM_PRESETS] = rev->param_table;
+    void *mem = rev->param_table_mem;
+    struct PsxTableSlot *slot = rev->param_table_slot;
+
+    /* the table of a block belongs to the instance alone */
+    if (!mem && !slot) {
+        table_fill(rev, (PsxReverbParams (*)[NUM_PRESETS])table);
+        return true;
+    }
+
+    if (!table_open(rev)) {
+        rev->param_table = table;
+        rev->param_table_mem = mem;
+        rev->param_table_slot = slot;
+        return false;
+    }
+#ifdef PSX_REV_ATOMICS
+    if (slot)
+        table_cache_release(slot);
+#endif
+    free(mem);
+    return true;
+}
+
+/**
+   Switch the instance to another samplerate.  Only the preset table is
+   converted again, or taken from the cache if another instance runs at that
+   rate.  The buffers that fit every preset are kept if they are large enough,
+   which they are up to the rate given as `#maxSampleRate` at instantiation;
+   a block can't grow, so higher rates are refused there.  The settings stay,
+   the tail is cleared.  While the worker still owns a buffer, the switch is
+   refused as well, hosts change the rate while the plugin is deactivated.
+*/
+static uint32_t
+reverb_rate(PsxReverb *rev, double rate)
+{
+    PsxReverb *fade = rev->fade;
+    const uint32_t pairs = rev->variant->pairs;
+    const bool block = !rev->param_table_mem && !rev->param_table_slot;
+
+    if ((float)rate == rev->rate)
+        return LV2_OPTIONS_SUCCESS;
+    if ((rev->switching && !rev->pending) || rev->custom_busy || rev->fade_state == PSX_REV_FADE_WORKER)
+        return LV2_OPTIONS_ERR_UNKNOWN;
+
+    const size_t shared_count = buffer_shared_count(rate);
+    const size_t longest_count = buffer_longest_count(rate);
+    const bool grow = !rev->spu_buffer_resize && rev->spu_buffer_count < longest_count;
+    const bool grow_fade = fade->spu_buffer_count < longest_count;
+
+    if (block && (grow || grow_fade)) {
+        lv2_log_error(&rev->logger, "Samplerate %f needs larger buffers than the instance has\n", rate);
+        return LV2_OPTIONS_ERR_BAD_VALUE;
+    }
+
+    pool_sync(rev);
+    float *buffer = grow ? calloc(longest_count * pairs, sizeof(float)) : NULL;
+    float *fade_buffer = grow_fade ? calloc(longest_count * pairs, sizeof(float)) : NULL;
+    const float old_rate = rev->rate;
+
+    if ((grow && !buffer) || (grow_fade && !fade_buffer)) {
+        free(buffer);
+        free(fade_buffer);
+        lv2_log_error(&rev->logger, "Could not allocate SPU buffer\n");
+        return LV2_OPTIONS_ERR_UNKNOWN;
+    }
+
+    reverb_setup(rev, rev->variant, rate);
+    if (!table_reopen(rev)) {
+        reverb_setup(rev, rev->variant, old_rate);
+        free(buffer);
+        free(fade_buffer);
+        lv2_log_error(&rev->logger, "Could not allocate preset table\n");
+        return LV2_OPTIONS_ERR_UNKNOWN;
+    }
+
+    if (buffer) {
+        free(rev->spu_buffer);
+        rev->spu_buffer = buffer;
+        rev->spu_buffer_count = longest_count;
+    }
+    if (fade_buffer) {
+        free(fade->spu_buffer);
+        fade->spu_buffer = fade_buffer;
+        fade->spu_buffer_count = longest_count;
+    }
+    /* the tail is laid out for the old rate */
+    memset(rev->spu_buffer, 0, rev->spu_buffer_count * pairs * sizeof(float));
+    memset(fade->spu_buffer, 0, fade->spu_buffer_count * pairs * sizeof(float));
+    rev->spu_buffer_dirty = 0;
+    fade->spu_buffer_dirty = 0;
+    if (!rev->spu_buffer_resize)
+        rev->spu_buffer_count_mask = shared_count - 1;
+    fade_setup(rev, fade, fade->spu_buffer, shared_count, fade->spu_buffer_count);
+    fade->params = NULL;
+
+    rev->native = rev->native && rev->net[0].resampler.factor > 1;
+    rev->switching = false;
+    rev->pending = NULL;
+    if (rev->custom_selected)
+        rev->custom_selected = custom_convert(rev, rev->custom_slot, rev->custom_registers[rev->custom_slot]);
+    preset_load(rev, rev->custom_selected ? PSX_REV_PRESET_CUSTOM : preset_index(rev, rev->preset_request));
+    networks_reset(rev);
+    return LV2_OPTIONS_SUCCESS;
+}
+
+/**
+   The options interface reports the samplerate and lets the host change it
+   without instantiating the plugin again, see `reverb_rate()`.  Both are in
+   the ``instantiation'' threading class.
+*/
+static uint32_t
+options_get(LV2_Handle instance, LV2_Options_Option *options)
+{
+    PsxReverb *rev = (PsxReverb *)instance;
+    uint32_t status = LV2_OPTIONS_SUCCESS;
+
+    for (LV2_Options_Option *opt = options; opt->key; opt++) {
+        if (opt->context != LV2_OPTIONS_INSTANCE || opt->key != rev->uris.param_sampleRate) {
+            status |= LV2_OPTIONS_ERR_BAD_KEY;
+            continue;
+        }
+        opt->size = sizeof(rev->rate);
+        opt->type = rev->uris.atom_Float;
+        opt->value = &rev->rate;
+    }
+    return status;
+}
+
+static uint32_t
+options_set(LV2_Handle instance, const LV2_Options_Option *options)
+{
+    PsxReverb *rev = (PsxReverb *)instance;
+    uint32_t status = LV2_OPTIONS_SUCCESS;
+    double rate;
+
+    for (const LV2_Options_Option *opt = options; opt->key; opt++) {
+        if (opt->context != LV2_OPTIONS_INSTANCE || opt->key != rev->uris.param_sampleRate)
+            status |= LV2_OPTIONS_ERR_BAD_KEY;
+        else if (!option_rate(opt, rev->map, &rate))
+            status |= LV2_OPTIONS_ERR_BAD_VALUE;
+        else
+            status |= reverb_rate(rev, rate);
+    }
+    return status;
+}
+
+/**
+   The `extension_data()` function returns any extension data supported by the
+   plugin.  Note that this is not an instance method, but a function on the
+   plugin descriptor.  It is usually used by plugins to implement additional
+   interfaces.  This plugin provides the worker interface for switching
+   presets, the state interface and the options interface.
+
+   This method is in the ``discovery'' threading class, so no other functions
+   or methods in this plugin library will be called concurrently with it.
+*/
+static const void*
+extension_data(const char* uri)
+{
+    static const LV2_Worker_Interface worker = { work, work_response, NULL };
+    static const LV2_State_Interface state = { state_save, state_restore };
+    static const LV2_Options_Interface options = { options_get, options_set };
+
+    if (!strcmp(uri, LV2_WORKER__interface))
+        return &worker;
+    if (!strcmp(uri, LV2_STATE__interface))
+        return &state;
+    if (!strcmp(uri, LV2_OPTIONS__interface))
+        return &options;
+    return NULL;
+}
+
+/**
+   Every plugin must define an `LV2_Descriptor`.  It is best to define
+   descriptors statically to avoid leaking memory and non-portable shared
+   library constructors and destructors to clean up properly.  The variants
+   only differ in their URI, `instantiate()` looks up their ports in
+   `variants`.
+*/
+#define PSX_REV_DESCRIPTOR(uri) \
+    { uri, instantiate, connect_port, activate, run, deactivate, cleanup, extension_data }
+
+static const LV2_Descriptor descriptors[NUM_VARIANTS] = {
+    PSX_REV_DESCRIPTOR(PSX_REV_URI),
+    PSX_REV_DESCRIPTOR(PSX_REV_URI_MONO),
+    PSX_REV_DESCRIPTOR(PSX_REV_URI_8CH),
+};
+
+/**
    The `lv2_descriptor()` function is the entry point to the plugin library.  The
    host will load the library and call this function repeatedly with increasing
    indices to find all the plugins defined in the library.  The index is not an
@@ -452,15 +4388,568 @@ LV2_SYMBOL_EXPORT
 const LV2_Descriptor*
 lv2_descriptor(uint32_t index)
 {
-    switch (index) {
-    case 0:  return &descriptor;
-    default: return NULL;
+    if (index < NUM_VARIANTS)
+        return &descriptors[index];
+    return NULL;
+}
+
+/**
+   The C interface of psx-reverb.h runs the same instance as the plugin, only
+   without host features.  There is no worker, so preset switches clear the
+   buffer in steps, see `process_controls()`.
+*/
+size_t
+psx_reverb_size(PsxReverbLayout layout, double rate)
+{
+    PsxReverbBlock block;
+
+    if (!reverb_block(layout, rate, &block))
+        return 0;
+    return block.end + PSX_REV_CACHE_LINE - 1;
+}
+
+PsxReverb *
+psx_reverb_init(void *mem, size_t size, PsxReverbLayout layout, double rate)
+{
+    PsxReverbBlock block;
+
+    if (!mem || !reverb_block(layout, rate, &block) || size < block.end + PSX_REV_CACHE_LINE - 1)
+        return NULL;
+
+    uint8_t *base = (uint8_t *)PSX_REV_ALIGN((uintptr_t)mem);
+    memset(base, 0, block.end);
+
+    PsxReverb *rev = reverb_block_init(base, &block, &variants[layout], rate);
+    reverb_reset(rev);
+    return rev;
+}
+
+void
+psx_reverb_reset(PsxReverb *rev)
+{
+    reverb_reset(rev);
+}
+
+void
+psx_reverb_set_preset(PsxReverb *rev, int preset)
+{
+    rev->custom_selected = false;
+    preset_index(rev, preset);
+}
+
+bool
+psx_reverb_set_registers(PsxReverb *rev, const uint16_t registers[PSX_REVERB_REGISTERS])
+{
+    const uint32_t slot = rev->custom_slot ^ 1;
+    const PsxReverbParams *first = rev->custom[slot];
+    const PsxReverbParams *last = rev->custom[slot] + NUM_RATES;
+
+    /* the other set may still be read by a switch in run() steps or a crossfade, see custom_schedule() */
+    if ((rev->params >= first && rev->params < last) ||
+        (rev->pending >= first && rev->pending < last) ||
+        (rev->fade->params >= first && rev->fade->params < last))
+        return false;
+    if (!custom_convert(rev, slot, registers))
+        return false;
+
+    rev->custom_slot = slot;
+    rev->custom_selected = true;
+    return true;
+}
+
+void
+psx_reverb_set_levels(PsxReverb *rev, float wet, float dry, float master)
+{
+    gain_set(&rev->wet, rev->gain_db, wet);
+    gain_set(&rev->dry, rev->gain_db, dry);
+    gain_set(&rev->master, rev->gain_db, master);
+}
+
+void
+psx_reverb_set_engine(PsxReverb *rev, PsxReverbEngineType engine, bool spu_rate)
+{
+    rev->engine_request = engine_index((float)engine);
+    rev->native_request = spu_rate;
+}
+
+void
+psx_reverb_set_crossfade(PsxReverb *rev, float ms)
+{
+    rev->crossfade = ms;
+}
+
+void
+psx_reverb_process(PsxReverb *rev, const float *const *in, float *const *out, uint32_t n)
+{
+    const uint64_t fp_state = denormals_flush();
+
+    memcpy(rev->in, in, rev->variant->inputs * sizeof(in[0]));
+    memcpy(rev->out, out, 2 * rev->variant->pairs * sizeof(out[0]));
+    process_controls(rev, true);
+    process_span(rev, 0, n);
+    denormals_restore(fp_state);
+}
+
+/* interleaved frames go through planar chunks on the stack */
+void
+psx_reverb_process_interleaved(PsxReverb *rev, const float *in, float *out, uint32_t n)
+{
+    const uint32_t inputs = rev->variant->inputs;
+    const uint32_t outputs = 2 * rev->variant->pairs;
+    const uint64_t fp_state = denormals_flush();
+    float in_chunk[2 * PSX_REV_PAIRS_MAX][PSX_REV_CHUNK];
+    float out_chunk[2 * PSX_REV_PAIRS_MAX][PSX_REV_CHUNK];
+
+    for (uint32_t c = 0; c < inputs; c++)
+        rev->in[c] = in_chunk[c];
+    for (uint32_t c = 0; c < outputs; c++)
+        rev->out[c] = out_chunk[c];
+
+    for (uint32_t offset = 0; offset < n; offset += PSX_REV_CHUNK) {
+        const uint32_t len = (n - offset < PSX_REV_CHUNK) ? n - offset : PSX_REV_CHUNK;
+        const float *src = in + (size_t)offset * inputs;
+        float *dst = out + (size_t)offset * outputs;
+
+        for (uint32_t i = 0; i < len; i++) {
+            for (uint32_t c = 0; c < inputs; c++)
+                in_chunk[c][i] = src[i * inputs + c];
+        }
+        process_controls(rev, offset == 0);
+        process_span(rev, 0, len);
+        for (uint32_t i = 0; i < len; i++) {
+            for (uint32_t c = 0; c < outputs; c++)
+                dst[i * outputs + c] = out_chunk[c][i];
+        }
+    }
+    denormals_restore(fp_state);
+}
+
+/**
+   A bank of stereo reverbs on the shared engine at host rate that share one
+   parameter set, see psx-reverb.h.  The instances are split into groups of
+   `PSX_REV_BANK_WIDTH` lanes, the padding lanes of the last group only ever
+   see silence.  Each group has a buffer of its own in which row `a` holds
+   address `a` of every lane, so a tap of the network is one contiguous load
+   for the whole group, and each stage is a few `v8f` operations.  Each lane
+   does the same operations in the same order as `spu_reverb_step()`, and a
+   stage runs over all lanes before the next one reads the buffer, so lanes
+   whose taps alias behave like the scalar kernel.
+*/
+#define PSX_REV_BANK_WIDTH 8
+
+struct PsxReverbBank {
+    uint32_t        count;          // instances
+    uint32_t        groups;         // of PSX_REV_BANK_WIDTH lanes
+    float           rate;
+    int             preset;         // -1 for custom registers
+    PsxReverbParams params;         // in use
+    PsxReverbParams next;           // switched to once the buffer is clear
+    bool            switching;
+    size_t          clear_pos;      // rows, see bank_clear_step()
+    size_t          rows;           // per group, a power of two fitting every preset
+    size_t          dirty;          // rows written since the last clear
+    uint32_t        BufferAddress;
+    uint32_t        tail;           // like PsxReverb, for the whole bank
+    uint32_t        quiet;
+    PsxGain         wet;
+    PsxGain         dry;
+    PsxGain         master;
+    float           gain_decay[PSX_REV_CHUNK + 1];
+    float           gain_db[PSX_REV_DB_TABLE];
+    float          *x;              // input of a chunk, [group][sample][side][lane]
+    float          *y;              // wet output of a chunk, the same
+    float          *buffer;         // [group][row][lane]
+};
+
+/* offsets of the scratch and the buffers in a bank's block */
+static bool
+bank_block(uint32_t count, double rate, size_t *scratch, size_t *buffer, size_t *end)
+{
+    if (count < 1 || count > PSX_REVERB_BANK_MAX || !(rate > 1.0))
+        return false;
+
+    const size_t lanes = (count + PSX_REV_BANK_WIDTH - 1) / PSX_REV_BANK_WIDTH * PSX_REV_BANK_WIDTH;
+    *scratch = PSX_REV_ALIGN(sizeof(PsxReverbBank));
+    *buffer = *scratch + 2 * PSX_REV_ALIGN(2 * PSX_REV_CHUNK * lanes * sizeof(float));
+    *end = *buffer + PSX_REV_ALIGN(buffer_shared_count(rate) * lanes * sizeof(float));
+    return true;
+}
+
+static void
+bank_switch_done(PsxReverbBank *bank, size_t dirty)
+{
+    bank->params = bank->next;
+    bank->switching = false;
+    bank->dirty = dirty;
+    bank->BufferAddress = 0;
+    bank->tail = (uint32_t)bank->params.buffer_count;
+    bank->quiet = bank->tail;
+}
+
+/**
+   Clear some rows of every group's buffer while switching, at most
+   `PSX_REV_CLEAR_CHUNK` floats over all groups like preset_clear_step()
+   does for a single instance without worker.  The whole buffer is in use,
+   so whatever was written is cleared.
+*/
+static void
+bank_clear_step(PsxReverbBank *bank)
+{
+    const size_t group = bank->rows * PSX_REV_BANK_WIDTH;
+    const size_t rows = PSX_REV_CLEAR_CHUNK / (PSX_REV_BANK_WIDTH * bank->groups);
+    const size_t step = rows ? rows : 1;
+    size_t n = bank->dirty - bank->clear_pos;
+
+    if (n > step)
+        n = step;
+    for (uint32_t g = 0; g < bank->groups; g++) {
+        memset(bank->buffer + g * group + bank->clear_pos * PSX_REV_BANK_WIDTH, 0,
+               n * PSX_REV_BANK_WIDTH * sizeof(bank->buffer[0]));
+    }
+    bank->clear_pos += n;
+    if (bank->clear_pos == bank->dirty)
+        bank_switch_done(bank, 0);
+}
+
+/*
+   A row of a group as one vector.  With GCC and clang, this is a vector type
+   that the compiler maps to two SSE2/NEON registers, or a single one in the
+   AVX build of bank_network(), on other compilers a plain loop.
+*/
+#if defined(__GNUC__)
+#if !defined(__clang__)
+/* no vector is passed to a function that isn't inlined, so the ABI doesn't matter (GCC warns at the end of the file) */
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+typedef float v8f __attribute__((vector_size(PSX_REV_BANK_WIDTH * sizeof(float))));
+#define v8f_add(a, b)   ((a) + (b))
+#define v8f_sub(a, b)   ((a) - (b))
+#define v8f_mul(a, b)   ((a) * (b))
+static PSX_REV_INLINE v8f v8f_dup(float a) {
+    const v8f v = { a, a, a, a, a, a, a, a };
+    return v;
+}
+#else
+typedef struct { float v[PSX_REV_BANK_WIDTH]; } v8f;
+#define V8F_OP(name, op) \
+static PSX_REV_INLINE v8f name(v8f a, v8f b) { \
+    for (uint32_t j = 0; j < PSX_REV_BANK_WIDTH; j++) \
+        a.v[j] = a.v[j] op b.v[j]; \
+    return a; \
+}
+V8F_OP(v8f_add, +)
+V8F_OP(v8f_sub, -)
+V8F_OP(v8f_mul, *)
+#undef V8F_OP
+static PSX_REV_INLINE v8f v8f_dup(float a) {
+    v8f v;
+    for (uint32_t j = 0; j < PSX_REV_BANK_WIDTH; j++)
+        v.v[j] = a;
+    return v;
+}
+#endif
+
+static PSX_REV_INLINE v8f v8f_load(const float *p) {
+    v8f v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+#define v8f_store(p, a) do { \
+    const v8f v8f_value = (a); \
+    memcpy(p, &v8f_value, sizeof(v8f_value)); \
+} while (0)
+
+/* run n samples of one group through the network, each like spu_reverb_step() */
+static PSX_REV_INLINE void
+bank_group_topo(PsxReverbBank *bank, float *buf, const float *x, float *y, uint32_t n, const unsigned topo)
+{
+    const PsxReverbParams *p = &bank->params;
+    const uint32_t mask = (uint32_t)bank->rows - 1;
+    const bool delay = topo & PSX_REV_TOPO_APF;
+    const v8f vWALL = v8f_dup(p->vWALL), vIIR = v8f_dup(p->vIIR);
+    const v8f vCOMB1 = v8f_dup(p->vCOMB1), vCOMB2 = v8f_dup(p->vCOMB2);
+    const v8f vCOMB3 = v8f_dup(p->vCOMB3), vCOMB4 = v8f_dup(p->vCOMB4);
+    const v8f vAPF1 = v8f_dup(p->vAPF1), vAPF2 = v8f_dup(p->vAPF2);
+    uint32_t address = bank->BufferAddress;
+
+    for (uint32_t i = 0; i < n; i++) {
+        const v8f xl = v8f_load(x + i * 2 * PSX_REV_BANK_WIDTH);
+        const v8f xr = v8f_load(x + (i * 2 + 1) * PSX_REV_BANK_WIDTH);
+        v8f yl, yr;
+
+        /*
+           The stages are macros rather than functions, GCC notes an ABI
+           change for 32 byte vector parameters even if they are inlined.
+        */
+#define row(idx) (buf + (size_t)((unsigned)((idx) + address) & mask) * PSX_REV_BANK_WIDTH)
+        // same and different side reflection, the row written may be one of those read
+#define REFLECT(m, in, d) { \
+            const v8f last = v8f_load(row((m)-1)); \
+            v8f_store(row(m), v8f_add(v8f_mul(v8f_sub(v8f_add(in, v8f_mul(v8f_load(row(d)), vWALL)), last), vIIR), last)); \
+        }
+        REFLECT(p->mLSAME, xl, p->dLSAME)
+        REFLECT(p->mRSAME, xr, p->dRSAME)
+        if (!(topo & PSX_REV_TOPO_DIFF)) {
+            REFLECT(p->mLDIFF, xl, p->dRDIFF)
+            REFLECT(p->mRDIFF, xr, p->dLDIFF)
+        }
+#undef REFLECT
+
+        // early echo
+        yl = v8f_mul(vCOMB1, v8f_load(row(p->mLCOMB1)));
+        yr = v8f_mul(vCOMB1, v8f_load(row(p->mRCOMB1)));
+        if (!(topo & PSX_REV_TOPO_COMB2)) {
+            yl = v8f_add(yl, v8f_mul(vCOMB2, v8f_load(row(p->mLCOMB2))));
+            yr = v8f_add(yr, v8f_mul(vCOMB2, v8f_load(row(p->mRCOMB2))));
+        }
+        if (!(topo & PSX_REV_TOPO_COMB34)) {
+            yl = v8f_add(yl, v8f_mul(vCOMB3, v8f_load(row(p->mLCOMB3))));
+            yl = v8f_add(yl, v8f_mul(vCOMB4, v8f_load(row(p->mLCOMB4))));
+            yr = v8f_add(yr, v8f_mul(vCOMB3, v8f_load(row(p->mRCOMB3))));
+            yr = v8f_add(yr, v8f_mul(vCOMB4, v8f_load(row(p->mRCOMB4))));
+        }
+
+        // late reverb APF1 and APF2, the source is read again after the stage is written like in the scalar kernel
+#define APF_STAGE(out, mAPF, dAPF, vAPF) \
+        if (delay) { \
+            v8f_store(row(mAPF), out); \
+            out = v8f_load(row((mAPF)-(dAPF))); \
+        } else { \
+            out = v8f_sub(out, v8f_mul(vAPF, v8f_load(row((mAPF)-(dAPF))))); \
+            v8f_store(row(mAPF), out); \
+            out = v8f_add(v8f_mul(out, vAPF), v8f_load(row((mAPF)-(dAPF)))); \
+        }
+        APF_STAGE(yl, p->mLAPF1, p->dAPF1, vAPF1)
+        APF_STAGE(yr, p->mRAPF1, p->dAPF1, vAPF1)
+        APF_STAGE(yl, p->mLAPF2, p->dAPF2, vAPF2)
+        APF_STAGE(yr, p->mRAPF2, p->dAPF2, vAPF2)
+#undef APF_STAGE
+#undef row
+
+        v8f_store(y + i * 2 * PSX_REV_BANK_WIDTH, yl);
+        v8f_store(y + (i * 2 + 1) * PSX_REV_BANK_WIDTH, yr);
+        address = (address + 1) & mask;
+    }
+}
+
+/* x86-64 CPUs with AVX run the bank's network on it, chosen when the library is loaded */
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__GLIBC__) && !defined(__AVX__)
+#define PSX_REV_BANK_CLONES __attribute__((target_clones("avx", "default")))
+#else
+#define PSX_REV_BANK_CLONES
+#endif
+
+/* run n samples of every group through the network with the kernel for the preset's topology, y is unused if silent */
+PSX_REV_BANK_CLONES static void
+bank_network(PsxReverbBank *bank, uint32_t n)
+{
+    const unsigned topo = bank->params.topology;
+    const size_t chunk = 2 * PSX_REV_CHUNK * PSX_REV_BANK_WIDTH;
+
+    if (!(topo & PSX_REV_TOPO_SILENT)) {
+        for (uint32_t g = 0; g < bank->groups; g++) {
+            float *buf = bank->buffer + g * bank->rows * PSX_REV_BANK_WIDTH;
+
+            switch (topo) {
+#define TOPOLOGY(t) \
+            case t: \
+                bank_group_topo(bank, buf, bank->x + g * chunk, bank->y + g * chunk, n, t); \
+                break;
+            PSX_REV_TOPOLOGIES(TOPOLOGY)
+#undef TOPOLOGY
+            }
+        }
+    }
+    bank->BufferAddress = (uint32_t)((bank->BufferAddress + n) & (bank->rows - 1));
+}
+
+/* where sample i of side `side` of instance j is in x and y */
+static inline size_t
+bank_lane(uint32_t j, uint32_t i, uint32_t side)
+{
+    return ((j / PSX_REV_BANK_WIDTH * PSX_REV_CHUNK + i) * 2 + side) * PSX_REV_BANK_WIDTH + j % PSX_REV_BANK_WIDTH;
+}
+
+/* whether the wet output of the last n samples is audible, older samples may be left further on in y */
+static bool
+bank_audible(const PsxReverbBank *bank, uint32_t n)
+{
+    const size_t chunk = 2 * PSX_REV_CHUNK * PSX_REV_BANK_WIDTH;
+
+    for (uint32_t g = 0; g < bank->groups; g++) {
+        if (audible(bank->y + g * chunk, 2 * n * PSX_REV_BANK_WIDTH))
+            return true;
+    }
+    return false;
+}
+
+/**
+   Run a chunk of all instances: gather the inputs into lanes, run the
+   network unless the whole bank is idle (see network_idle()), and mix each
+   instance with the shared gains like process_mix() does for a single one.
+   The lanes are only gathered and scattered while the network has any.
+*/
+static void
+bank_chunk(PsxReverbBank *bank, const float *const *in, float *const *out, uint32_t offset, uint32_t n)
+{
+    static const float silence[PSX_REV_CHUNK];
+    const PsxReverbParams *p = &bank->params;
+    const bool lanes = !(p->topology & PSX_REV_TOPO_SILENT);
+    bool wet = false;
+    PsxMix mix;
+
+    for (uint32_t j = 0; j < bank->count && bank->quiet; j++) {
+        if (audible(in[2 * j] + offset, n) || audible(in[2 * j + 1] + offset, n))
+            bank->quiet = 0;
+    }
+
+    if (!bank->switching && bank->quiet < bank->tail) {
+        for (uint32_t j = 0; j < bank->count && lanes; j++) {
+            const float *in0 = in[2 * j] + offset;
+            const float *in1 = in[2 * j + 1] + offset;
+            float *x = bank->x + bank_lane(j, 0, 0);
+
+            for (uint32_t i = 0; i < n; i++) {
+                x[2 * i * PSX_REV_BANK_WIDTH] = p->vLIN * in0[i];
+                x[(2 * i + 1) * PSX_REV_BANK_WIDTH] = p->vRIN * in1[i];
+            }
+        }
+        bank_network(bank, n);
+        bank->dirty = bank->rows;
+        wet = lanes;
+        if (lanes && bank_audible(bank, n))
+            bank->quiet = 0;
+        else if (bank->quiet < bank->tail)
+            bank->quiet += n;
+    }
+
+    mix.ramp = gain_ramp(&bank->wet, bank->gain_decay, n, &mix.wet, &mix.wet_step);
+    mix.ramp |= gain_ramp(&bank->dry, bank->gain_decay, n, &mix.dry, &mix.dry_step);
+    mix.ramp |= gain_ramp(&bank->master, bank->gain_decay, n, &mix.master, &mix.master_step);
+    for (uint32_t j = 0; j < bank->count; j++) {
+        float wet0[PSX_REV_CHUNK];
+        float wet1[PSX_REV_CHUNK];
+
+        if (wet) {
+            const float *y = bank->y + bank_lane(j, 0, 0);
+            for (uint32_t i = 0; i < n; i++) {
+                wet0[i] = y[2 * i * PSX_REV_BANK_WIDTH];
+                wet1[i] = y[(2 * i + 1) * PSX_REV_BANK_WIDTH];
+            }
+        }
+        process_mix(p, &mix, in[2 * j] + offset, in[2 * j + 1] + offset, wet ? wet0 : silence,
+                    wet ? wet1 : silence, out[2 * j] + offset, out[2 * j + 1] + offset, n);
+    }
+}
+
+size_t
+psx_reverb_bank_size(uint32_t count, double rate)
+{
+    size_t scratch, buffer, end;
+
+    if (!bank_block(count, rate, &scratch, &buffer, &end))
+        return 0;
+    return end + PSX_REV_CACHE_LINE - 1;
+}
+
+PsxReverbBank *
+psx_reverb_bank_init(void *mem, size_t size, uint32_t count, double rate)
+{
+    size_t scratch, buffer, end;
+
+    if (!mem || !bank_block(count, rate, &scratch, &buffer, &end) || size < end + PSX_REV_CACHE_LINE - 1)
+        return NULL;
+
+    uint8_t *base = (uint8_t *)PSX_REV_ALIGN((uintptr_t)mem);
+    memset(base, 0, end);
+
+    PsxReverbBank *bank = (PsxReverbBank *)base;
+    bank->count = count;
+    bank->groups = (count + PSX_REV_BANK_WIDTH - 1) / PSX_REV_BANK_WIDTH;
+    bank->rate = (float)rate;
+    bank->rows = buffer_shared_count(rate);
+    bank->x = (float *)(base + scratch);
+    bank->y = bank->x + (buffer - scratch) / 2 / sizeof(float);
+    bank->buffer = (float *)(base + buffer);
+    gain_tables(bank->gain_decay, bank->gain_db);
+    psx_reverb_bank_reset(bank);
+    return bank;
+}
+
+void
+psx_reverb_bank_reset(PsxReverbBank *bank)
+{
+    memset(bank->buffer, 0, bank->groups * bank->rows * PSX_REV_BANK_WIDTH * sizeof(bank->buffer[0]));
+    gain_reset(&bank->wet);
+    gain_reset(&bank->dry);
+    gain_reset(&bank->master);
+    bank->preset = 0;
+    preset_convert(&bank->next, 0, bank->rate);
+    bank_switch_done(bank, 0);
+}
+
+void
+psx_reverb_bank_set_preset(PsxReverbBank *bank, int preset)
+{
+    if (preset < 0)
+        preset = 0;
+    if (preset >= NUM_PRESETS)
+        preset = NUM_PRESETS - 1;
+    if (preset == bank->preset)
+        return;
+
+    bank->preset = preset;
+    preset_convert(&bank->next, preset, bank->rate);
+    bank->switching = true;
+    bank->clear_pos = 0;
+}
+
+bool
+psx_reverb_bank_set_registers(PsxReverbBank *bank, const uint16_t registers[PSX_REVERB_REGISTERS])
+{
+    const PsxReverbPreset *preset = (const PsxReverbPreset *)registers;
+    const uint32_t size = preset_size(preset);
+    PsxReverbParams params;
+
+    if (size > SPU_REV_MEM_MAX)
+        return false;
+    preset_convert_registers(&params, preset, size, bank->rate);
+    if (params.buffer_count > bank->rows)
+        return false;
+
+    bank->preset = -1;
+    bank->next = params;
+    bank->switching = true;
+    bank->clear_pos = 0;
+    return true;
+}
+
+void
+psx_reverb_bank_set_levels(PsxReverbBank *bank, float wet, float dry, float master)
+{
+    gain_set(&bank->wet, bank->gain_db, wet);
+    gain_set(&bank->dry, bank->gain_db, dry);
+    gain_set(&bank->master, bank->gain_db, master);
+}
+
+void
+psx_reverb_bank_process(PsxReverbBank *bank, const float *const *in, float *const *out, uint32_t n)
+{
+    const uint64_t fp_state = denormals_flush();
+
+    if (bank->switching)
+        bank_clear_step(bank);
+    for (uint32_t offset = 0; offset < n; offset += PSX_REV_CHUNK) {
+        const uint32_t len = (n - offset < PSX_REV_CHUNK) ? n - offset : PSX_REV_CHUNK;
+        bank_chunk(bank, in, out, offset, len);
     }
+    denormals_restore(fp_state);
 }
 
 /* My own stuff. PSX standard presets used in most games can be found here */
 
-typedef struct PsxReverbPreset {
+struct PsxReverbPreset {
     uint16_t dAPF1;
     uint16_t dAPF2;
     int16_t  vIIR;
@@ -493,58 +4982,117 @@ typedef struct PsxReverbPreset {
     uint16_t mRAPF2;
     int16_t  vLIN;
     int16_t  vRIN;
-} PsxReverbPreset;
+};
 
-void preset_load(PsxReverb *psx_rev, int preset_index) {
-    // even if loading preset fails, set the ID regardless so we don't get log spam
-    psx_rev->preset = preset_index;
+/* bytes of SPU RAM from the reverb base up to the highest address the registers use */
+uint32_t preset_size(const PsxReverbPreset *preset) {
+    const uint16_t addr[] = {
+        preset->mLSAME, preset->mRSAME, preset->mLCOMB1, preset->mRCOMB1, preset->mLCOMB2, preset->mRCOMB2,
+        preset->dLSAME, preset->dRSAME, preset->mLDIFF, preset->mRDIFF, preset->mLCOMB3, preset->mRCOMB3,
+        preset->mLCOMB4, preset->mRCOMB4, preset->dLDIFF, preset->dRDIFF, preset->mLAPF1, preset->mRAPF1,
+        preset->mLAPF2, preset->mRAPF2,
+    };
+    uint32_t highest = 0;
 
-    if (preset_index >= NUM_PRESETS) {
-        lv2_log_error(&psx_rev->logger, "Invalid Preset: %d\n", preset_index);
-        return;
+    for (size_t i = 0; i < sizeof(addr) / sizeof(addr[0]); i++) {
+        if (highest < addr[i])
+            highest = addr[i];
     }
+    return (highest + 1) * 8;
+}
+
+void preset_convert(PsxReverbParams *params, int preset_index, float spu_rate) {
+    preset_convert_registers(params, (const PsxReverbPreset *)&presets[preset_index],
+                             preset_mem_size[preset_index], spu_rate);
+}
 
-    float stretch_factor = psx_rev->rate / SPU_REV_RATE;
+/* convert registers using `mem_size` bytes of SPU RAM to `spu_rate` */
+void preset_convert_registers(PsxReverbParams *params, const PsxReverbPreset *preset, uint32_t mem_size, float spu_rate) {
+    float stretch_factor = spu_rate / SPU_REV_RATE;
 
-    PsxReverbPreset *preset = (PsxReverbPreset *)&presets[psx_rev->preset];
+    params->buffer_count = ceilpower2((uint32_t)ceil(mem_size / 2 * stretch_factor));
 
-    psx_rev->dAPF1   = (uint32_t)((preset->dAPF1 << 2) * stretch_factor);
-    psx_rev->dAPF2   = (uint32_t)((preset->dAPF2 << 2) * stretch_factor);
+    params->dAPF1   = (uint32_t)((preset->dAPF1 << 2) * stretch_factor);
+    params->dAPF2   = (uint32_t)((preset->dAPF2 << 2) * stretch_factor);
     // correct 22050 Hz IIR alpha to our actual rate
-    psx_rev->vIIR    = fc2alpha(alpha2fc(s2f(preset->vIIR), SPU_REV_RATE), psx_rev->rate);
-    psx_rev->vCOMB1  = s2f(preset->vCOMB1);
-    psx_rev->vCOMB2  = s2f(preset->vCOMB2);
-    psx_rev->vCOMB3  = s2f(preset->vCOMB3);
-    psx_rev->vCOMB4  = s2f(preset->vCOMB4);
-    psx_rev->vWALL   = s2f(preset->vWALL);
-    psx_rev->vAPF1   = s2f(preset->vAPF1);
-    psx_rev->vAPF2   = s2f(preset->vAPF2);
-    psx_rev->mLSAME  = (uint32_t)((preset->mLSAME << 2) * stretch_factor);
-    psx_rev->mRSAME  = (uint32_t)((preset->mRSAME << 2) * stretch_factor);
-    psx_rev->mLCOMB1 = (uint32_t)((preset->mLCOMB1 << 2) * stretch_factor);
-    psx_rev->mRCOMB1 = (uint32_t)((preset->mRCOMB1 << 2) * stretch_factor);
-    psx_rev->mLCOMB2 = (uint32_t)((preset->mLCOMB2 << 2) * stretch_factor);
-    psx_rev->mRCOMB2 = (uint32_t)((preset->mRCOMB2 << 2) * stretch_factor);
-    psx_rev->dLSAME  = (uint32_t)((preset->dLSAME << 2) * stretch_factor);
-    psx_rev->dRSAME  = (uint32_t)((preset->dRSAME << 2) * stretch_factor);
-    psx_rev->mLDIFF  = (uint32_t)((preset->mLDIFF << 2) * stretch_factor);
-    psx_rev->mRDIFF  = (uint32_t)((preset->mRDIFF << 2) * stretch_factor);
-    psx_rev->mLCOMB3 = (uint32_t)((preset->mLCOMB3 << 2) * stretch_factor);
-    psx_rev->mRCOMB3 = (uint32_t)((preset->mRCOMB3 << 2) * stretch_factor);
-    psx_rev->mLCOMB4 = (uint32_t)((preset->mLCOMB4 << 2) * stretch_factor);
-    psx_rev->mRCOMB4 = (uint32_t)((preset->mRCOMB4 << 2) * stretch_factor);
-    psx_rev->dLDIFF  = (uint32_t)((preset->dLDIFF << 2) * stretch_factor);
-    psx_rev->dRDIFF  = (uint32_t)((preset->dRDIFF << 2) * stretch_factor);
-    psx_rev->mLAPF1  = (uint32_t)((preset->mLAPF1 << 2) * stretch_factor);
-    psx_rev->mRAPF1  = (uint32_t)((preset->mRAPF1 << 2) * stretch_factor);
-    psx_rev->mLAPF2  = (uint32_t)((preset->mLAPF2 << 2) * stretch_factor);
-    psx_rev->mRAPF2  = (uint32_t)((preset->mRAPF2 << 2) * stretch_factor);
-    psx_rev->vLIN    = s2f(preset->vLIN);
-    psx_rev->vRIN    = s2f(preset->vRIN);
-
-    memset(psx_rev->spu_buffer, 0, psx_rev->spu_buffer_count * sizeof(psx_rev->spu_buffer[0]));
+    params->vIIR    = fc2alpha(alpha2fc(s2f(preset->vIIR), SPU_REV_RATE), spu_rate);
+    params->vCOMB1  = s2f(preset->vCOMB1);
+    params->vCOMB2  = s2f(preset->vCOMB2);
+    params->vCOMB3  = s2f(preset->vCOMB3);
+    params->vCOMB4  = s2f(preset->vCOMB4);
+    params->vWALL   = s2f(preset->vWALL);
+    params->vAPF1   = s2f(preset->vAPF1);
+    params->vAPF2   = s2f(preset->vAPF2);
+    params->mLSAME  = (uint32_t)((preset->mLSAME << 2) * stretch_factor);
+    params->mRSAME  = (uint32_t)((preset->mRSAME << 2) * stretch_factor);
+    params->mLCOMB1 = (uint32_t)((preset->mLCOMB1 << 2) * stretch_factor);
+    params->mRCOMB1 = (uint32_t)((preset->mRCOMB1 << 2) * stretch_factor);
+    params->mLCOMB2 = (uint32_t)((preset->mLCOMB2 << 2) * stretch_factor);
+    params->mRCOMB2 = (uint32_t)((preset->mRCOMB2 << 2) * stretch_factor);
+    params->dLSAME  = (uint32_t)((preset->dLSAME << 2) * stretch_factor);
+    params->dRSAME  = (uint32_t)((preset->dRSAME << 2) * stretch_factor);
+    params->mLDIFF  = (uint32_t)((preset->mLDIFF << 2) * stretch_factor);
+    params->mRDIFF  = (uint32_t)((preset->mRDIFF << 2) * stretch_factor);
+    params->mLCOMB3 = (uint32_t)((preset->mLCOMB3 << 2) * stretch_factor);
+    params->mRCOMB3 = (uint32_t)((preset->mRCOMB3 << 2) * stretch_factor);
+    params->mLCOMB4 = (uint32_t)((preset->mLCOMB4 << 2) * stretch_factor);
+    params->mRCOMB4 = (uint32_t)((preset->mRCOMB4 << 2) * stretch_factor);
+    params->dLDIFF  = (uint32_t)((preset->dLDIFF << 2) * stretch_factor);
+    params->dRDIFF  = (uint32_t)((preset->dRDIFF << 2) * stretch_factor);
+    params->mLAPF1  = (uint32_t)((preset->mLAPF1 << 2) * stretch_factor);
+    params->mRAPF1  = (uint32_t)((preset->mRAPF1 << 2) * stretch_factor);
+    params->mLAPF2  = (uint32_t)((preset->mLAPF2 << 2) * stretch_factor);
+    params->mRAPF2  = (uint32_t)((preset->mRAPF2 << 2) * stretch_factor);
+    params->vLIN    = s2f(preset->vLIN);
+    params->vRIN    = s2f(preset->vRIN);
+    // the buffer may be larger (without worker), which only makes aliasing lanes rarer
+    simd_lanes_check(params, (uint32_t)params->buffer_count - 1);
+    lines_layout(params, (uint32_t)params->buffer_count - 1);
+    topology_check(params);
+
+    params->fixed.vIIR   = f2s(params->vIIR);
+    params->fixed.vCOMB1 = f2s(params->vCOMB1);
+    params->fixed.vCOMB2 = f2s(params->vCOMB2);
+    params->fixed.vCOMB3 = f2s(params->vCOMB3);
+    params->fixed.vCOMB4 = f2s(params->vCOMB4);
+    params->fixed.vWALL  = f2s(params->vWALL);
+    params->fixed.vAPF1  = f2s(params->vAPF1);
+    params->fixed.vAPF2  = f2s(params->vAPF2);
+}
+
+void preset_load(PsxReverb *psx_rev, int preset_index) {
+    const uint64_t start = stats_now();
+
+    psx_rev->preset = preset_index;
+    psx_rev->params = preset_params(psx_rev, psx_rev->native, psx_rev->engine, preset_index);
+    psx_rev->kernel = psx_rev->engine;
+
+    /* this only runs in the instantiation class, so the buffer can be reallocated */
+    const size_t count = engine_buffer_count(psx_rev->params, psx_rev->engine, psx_rev->params->buffer_count);
+    if (psx_rev->spu_buffer_resize && psx_rev->spu_buffer_count != count) {
+        float *buffer = calloc(count * psx_rev->variant->pairs, sizeof(float));
+        if (buffer) {
+            free(psx_rev->spu_buffer);
+            psx_rev->spu_buffer = buffer;
+            psx_rev->spu_buffer_count = count;
+            psx_rev->spu_buffer_dirty = 0;
+        }
+    }
+    if (psx_rev->spu_buffer_resize && psx_rev->spu_buffer_count >= count)
+        psx_rev->spu_buffer_count_mask = psx_rev->params->buffer_count - 1;
+
+    psx_rev->spu_buffer_used = engine_buffer_used(psx_rev, psx_rev->params, psx_rev->engine);
+    psx_rev->spu_buffer_dirty = buffer_clear(psx_rev->spu_buffer, psx_rev->spu_buffer_count, psx_rev->variant->pairs,
+                                             psx_rev->spu_buffer_dirty, psx_rev->spu_buffer_used);
+    psx_rev->stats.last.reloads++;
+    psx_rev->stats.reload_ns += stats_now() - start;
 }
 
+/* SPU mem required by each preset in bytes, see the comments below */
+static const uint32_t preset_mem_size[NUM_PRESETS] = {
+    0x26C0, 0x1F40, 0x4840, 0x6FE0, 0xADE0, 0x3C00, 0xF6C0, 0x18040, 0x18040, 0x10,
+};
+
 static const uint16_t presets[NUM_PRESETS][0x20] = {
     {
         /* Name: Room, SPU mem required: 0x26C0 */
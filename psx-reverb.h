@@ -0,0 +1,169 @@
+/*
+  Copyright 2023 Michael Panzlaff <michael.panlaff@fau.de>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/**
+   C interface to the reverb without LV2, e.g. to run it per bus of a game's
+   audio engine.  It is implemented in psx-reverb.c next to the plugin, which
+   runs on the same code.
+
+   All memory of an instance is a single block the caller provides, so it can
+   come from any arena or pool.  Nothing is allocated or freed after
+   `psx_reverb_init()`, and there is nothing to destroy: once the caller stops
+   using an instance, the block can be reused.  For real-time use the block
+   should be locked and, with large buffers, on huge pages, like the plugin
+   does with `PSX_REV_ARENA`.  Without the plugin's worker, preset switches
+   clear the reverb buffer over the next few blocks like in hosts without the
+   worker feature, during which the reverb is silent.
+
+   An instance must not be used from two threads at once.
+*/
+#ifndef PSX_REVERB_H
+#define PSX_REVERB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct PsxReverb PsxReverb;
+
+/* channel layouts, the same as the plugin variants */
+typedef enum {
+    PSX_REVERB_STEREO = 0,      // 2 in, 2 out
+    PSX_REVERB_MONO = 1,        // 1 in, 2 out
+    PSX_REVERB_8CH = 2,         // 8 in, 8 out, a reverb per channel pair
+} PsxReverbLayout;
+
+/* reverb network implementations, see the "Engine" port */
+typedef enum {
+    PSX_REVERB_ENGINE_SHARED = 0,
+    PSX_REVERB_ENGINE_LINES = 1,
+    PSX_REVERB_ENGINE_FIXED = 2,
+    PSX_REVERB_ENGINE_ECO = 3,
+} PsxReverbEngineType;
+
+#define PSX_REVERB_PRESETS 10
+#define PSX_REVERB_REGISTERS 0x20
+
+/** Bytes of memory an instance needs at `rate`, 0 if the rate or layout is not supported. */
+size_t
+psx_reverb_size(PsxReverbLayout layout, double rate);
+
+/**
+   Set up an instance in `mem`, which has to hold `psx_reverb_size()` bytes
+   and needs no particular alignment.  The instance starts at preset 0 and
+   0 dB like the plugin after activation.  Returns NULL if `size` is too
+   small.
+*/
+PsxReverb *
+psx_reverb_init(void *mem, size_t size, PsxReverbLayout layout, double rate);
+
+/** Clear the reverb tail and go back to the initial settings. */
+void
+psx_reverb_reset(PsxReverb *rev);
+
+/** Select one of the presets built in, this drops custom registers. */
+void
+psx_reverb_set_preset(PsxReverb *rev, int preset);
+
+/**
+   Select custom SPU reverb registers `dAPF1` to `vRIN`.  Returns false if
+   they don't fit the buffer or a crossfade still runs the last custom
+   registers, the preset in use is kept then.
+*/
+bool
+psx_reverb_set_registers(PsxReverb *rev, const uint16_t registers[PSX_REVERB_REGISTERS]);
+
+/** Set the wet, dry and master levels in dB, they are smoothed like the ports. */
+void
+psx_reverb_set_levels(PsxReverb *rev, float wet, float dry, float master);
+
+/** Select the engine and whether the network runs at SPU rate. */
+void
+psx_reverb_set_engine(PsxReverb *rev, PsxReverbEngineType engine, bool spu_rate);
+
+/** Crossfade preset switches over `ms` milliseconds instead of cutting the tail, 0 cuts it. */
+void
+psx_reverb_set_crossfade(PsxReverb *rev, float ms);
+
+/**
+   Process `n` frames of separate channel buffers, 1, 2 or 8 inputs and 2 or
+   8 outputs depending on the layout.  Inputs and outputs may be the same
+   buffers.
+*/
+void
+psx_reverb_process(PsxReverb *rev, const float *const *in, float *const *out, uint32_t n);
+
+/** Process `n` frames of interleaved samples, `in` may be the same as `out` unless the layout is mono. */
+void
+psx_reverb_process_interleaved(PsxReverb *rev, const float *in, float *out, uint32_t n);
+
+/**
+   A bank of up to `PSX_REVERB_BANK_MAX` stereo reverbs that share one preset
+   and one set of levels, e.g. one per voice bus of a game.  The buffers of
+   every 8 instances are interleaved, so each step of the network is a vector
+   operation over the 8 of them.  Built with GCC or clang, that is SSE2 or
+   NEON, and AVX on x86-64 CPUs that have it (see `psx-bench -k`).  A bank
+   runs the shared engine at host rate; each instance sounds exactly like a
+   `PsxReverb` with the same settings, except that the network is only
+   skipped once the whole bank is idle.  Like a single instance, it lives in
+   one block of memory the caller provides, and preset switches clear the
+   buffer over the next few calls.
+*/
+typedef struct PsxReverbBank PsxReverbBank;
+
+#define PSX_REVERB_BANK_MAX 64
+
+/** Bytes of memory a bank of `count` instances needs at `rate`, 0 if that is not supported. */
+size_t
+psx_reverb_bank_size(uint32_t count, double rate);
+
+/** Set up a bank in `mem` like `psx_reverb_init()`, at preset 0 and 0 dB. */
+PsxReverbBank *
+psx_reverb_bank_init(void *mem, size_t size, uint32_t count, double rate);
+
+/** Clear the tails of all instances and go back to the initial settings. */
+void
+psx_reverb_bank_reset(PsxReverbBank *bank);
+
+/** Select one of the presets built in for all instances. */
+void
+psx_reverb_bank_set_preset(PsxReverbBank *bank, int preset);
+
+/** Select custom SPU reverb registers for all instances, returns false if they don't fit the buffer. */
+bool
+psx_reverb_bank_set_registers(PsxReverbBank *bank, const uint16_t registers[PSX_REVERB_REGISTERS]);
+
+/** Set the wet, dry and master levels of all instances in dB. */
+void
+psx_reverb_bank_set_levels(PsxReverbBank *bank, float wet, float dry, float master);
+
+/**
+   Process `n` frames of every instance, `in` and `out` hold the left and
+   right buffers of instance `i` at `2 * i` and `2 * i + 1`.  Inputs and
+   outputs may be the same buffers.
+*/
+void
+psx_reverb_bank_process(PsxReverbBank *bank, const float *const *in, float *const *out, uint32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif